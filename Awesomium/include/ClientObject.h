@@ -27,12 +27,11 @@
 #define __CLIENTOBJECT_H__
 
 #include "webkit/glue/cpp_bound_class.h"
-#include "JSValue.h"
+#include "WebView.h"
+#include "base/hash_tables.h"
 
-namespace Awesomium { class WebView; }
+namespace WebKit { class WebFrame; }
 class NamedCallback;
-class FutureValueCallback;
-class CheckKeyboardFocusCallback;
 
 class ClientObject : public CppBoundClass
 {
@@ -40,19 +39,39 @@ public:
 	ClientObject(Awesomium::WebView* view);
 	~ClientObject();
 
-	void initInternalCallbacks();
+	/**
+	* Arrays and objects can only be created within a Javascript context, this tells us
+	* which one to use (the main frame's) and re-creates the array and object properties in it.
+	*/
+	void setWindowFrame(WebKit::WebFrame* frame);
 
 	void setProperty(const std::string& name, const Awesomium::JSValue& value);
 
-	void setCallback(const std::string& name);
+	void setCallback(const std::string& name, Awesomium::CoreThreadCallback* coreThreadHandler, Awesomium::CallbackHandler* handler);
+
+	void setCallbackPolicy(const std::string& name, Awesomium::CallbackPolicy policy, int maxPerSecond);
+
+	void setCallbackReceivesBuffers(const std::string& name, bool receivesBuffers);
 
 protected:
 
+	NamedCallback* getNamedCallback(const std::string& name);
+
 	std::map<std::string, CppVariant*> clientProperties;
-	std::map<std::string, NamedCallback*> clientCallbacks;
-	FutureValueCallback* futureValueCallback;
-	CheckKeyboardFocusCallback* checkKeyboardFocusCallback;
+	std::map<std::string, Awesomium::JSValue> containerProperties;
+	NPObject* windowObject;
+	base::hash_map<std::string, NamedCallback*> clientCallbacks;
 	Awesomium::WebView* view;
+
+	friend class NamedCallback;
 };
 
+// Converts a value from the bindings (a callback argument or the result of a script) to a JSValue. Only plain
+// arrays and objects are converted; other objects (functions, DOM nodes, events, windows) and repeated
+// references to an object (including cycles) become null.
+void initFromNPVariant(const NPVariant& variant, Awesomium::JSValue& result);
+
+// Converts a JSValue to a value for the bindings, arrays and objects are created in the context of 'windowObject'
+void initCppVariant(const Awesomium::JSValue& value, CppVariant& result, NPObject* windowObject, int depth = 0);
+
 #endif
@@ -28,29 +28,52 @@
 
 #include <string>
 #include <vector>
+#include <map>
 #include "PlatformUtils.h"
 
+// Whether or not the host's compiler supports rvalue references, JSValue is movable when it does. The move
+// members are defined inline (on top of JSValue::swap), so the library doesn't have to be built the same way.
+#if !defined(AWESOMIUM_HAS_RVALUE_REFS)
+#	if (defined(_MSC_VER) && _MSC_VER >= 1600) || (defined(__cplusplus) && __cplusplus >= 201103L) || defined(__GXX_EXPERIMENTAL_CXX0X__)
+#		define AWESOMIUM_HAS_RVALUE_REFS 1
+#	else
+#		define AWESOMIUM_HAS_RVALUE_REFS 0
+#	endif
+#endif
+
+namespace Awesomium { class JSValue; }
+
 namespace Impl {
 
+struct BufferStorage;
+
 typedef enum {
     VariantType_NULL,
 	VariantType_BOOLEAN,
 	VariantType_INTEGER,
 	VariantType_DOUBLE,
-	VariantType_STRING
+	VariantType_STRING,
+	VariantType_ARRAY,
+	VariantType_OBJECT,
+	VariantType_BUFFER
 } VariantType;
 
 struct VariantValue
 {
 	VariantType type;
 
-	std::string stringValue;
+	// For the other types, this caches the result of JSValue::toString
+	mutable std::string stringValue;
 
+	// Arrays and objects are held by pointer, so that they don't make every scalar JSValue bigger
 	union {
 		bool booleanValue;
 		int integerValue;
 		double doubleValue;
-	} numericValue;
+		std::vector<Awesomium::JSValue>* arrayValue;
+		std::map<std::string, Awesomium::JSValue>* objectValue;
+		BufferStorage* bufferValue;
+	} value;
 };
 
 }
@@ -60,14 +83,65 @@ namespace Awesomium
 
 class WebView;
 
+/**
+* JSBuffer is a reference-counted block of bytes, used to pass binary data between the
+* page and the host without copying it (see JSValue::isBuffer). Copies of a JSBuffer
+* share the same bytes.
+*
+* Pages have no binary types, so on their side a buffer is a 'binary string': a string in
+* which each character (with a code from 0 to 255) is one byte.
+*/
+class _OSMExport JSBuffer
+{
+public:
+	/// Creates an empty buffer.
+	JSBuffer();
+
+	/// Creates a buffer holding a copy of some bytes.
+	JSBuffer(const void* data, size_t size);
+
+	/// Creates a buffer of a certain size to be filled in via JSBuffer::getData, before it is shared.
+	explicit JSBuffer(size_t size);
+
+	/// Shares the bytes of another buffer.
+	JSBuffer(const JSBuffer& other);
+
+	~JSBuffer();
+
+	JSBuffer& operator=(const JSBuffer& rhs);
+
+	/// Returns the bytes of this buffer.
+	const unsigned char* getData() const;
+
+	/// Returns the bytes of this buffer for modification, they must not be modified once the buffer is shared.
+	unsigned char* getData();
+
+	/// Returns the number of bytes in this buffer.
+	size_t getSize() const;
+
+	/// Shortens this buffer (the memory is kept), the size can't be increased.
+	void truncate(size_t size);
+
+protected:
+	Impl::BufferStorage* storage;
+
+	friend class JSValue;
+};
+
 /**
 * JSValue is a class that represents a Javascript value. It can be initialized from
-* and converted to several types: boolean, integer, double, string
+* and converted to several types: boolean, integer, double, string, array, object and buffer.
 */
 class _OSMExport JSValue
 {
 	Impl::VariantValue varValue;
 public:
+	/// The elements of a Javascript array.
+	typedef std::vector<JSValue> Array;
+
+	/// The properties of a Javascript object, by name.
+	typedef std::map<std::string, JSValue> Object;
+
 	/// Creates a null JSValue.
 	JSValue();
 
@@ -86,6 +160,46 @@ public:
 	/// Creates a JSValue initialized with a string.
 	JSValue(const std::string& value);
 
+	/// Creates a JSValue initialized with an array.
+	JSValue(const Array& value);
+
+	/// Creates a JSValue initialized with an object.
+	JSValue(const Object& value);
+
+	/// Creates a JSValue that shares the bytes of a buffer.
+	JSValue(const JSBuffer& value);
+
+	/// Creates a (deep) copy of another JSValue.
+	JSValue(const JSValue& original);
+
+#if AWESOMIUM_HAS_RVALUE_REFS
+	/// Takes over the contents of another JSValue, leaving it null.
+	JSValue(JSValue&& original)
+	{
+		varValue.type = Impl::VariantType_NULL;
+		swap(original);
+	}
+
+	JSValue& operator=(JSValue&& rhs)
+	{
+		if(this != &rhs)
+		{
+			JSValue emptied;
+			swap(emptied);
+			swap(rhs);
+		}
+
+		return *this;
+	}
+#endif
+
+	~JSValue();
+
+	JSValue& operator=(const JSValue& rhs);
+
+	/// Exchanges the contents of this JSValue with another one, without copying.
+	void swap(JSValue& other);
+
 	/// Returns whether or not this JSValue is a boolean.
 	bool isBoolean() const;
 
@@ -104,14 +218,38 @@ public:
 	/// Returns whether or not this JSValue is null.
 	bool isNull() const;
 
+	/// Returns whether or not this JSValue is an array.
+	bool isArray() const;
+
+	/// Returns whether or not this JSValue is an object.
+	bool isObject() const;
+
+	/// Returns whether or not this JSValue is a buffer.
+	bool isBuffer() const;
+
 	/**
 	* Returns this JSValue as a string (converting if necessary).
 	*
-	* @note	If this JSValue is not a string, the returned reference
-	*		is only valid until the next call to JSValue::toString.
+	* @note	If this JSValue is not a string, the returned reference is only valid until this
+	*		JSValue is modified or destroyed. The conversion is cached within this JSValue, so
+	*		don't call this on the same JSValue from several threads at once; use the other
+	*		overload of JSValue::toString for that.
 	*/
 	const std::string& toString() const;
 
+	/**
+	* Writes this JSValue as a string (converting if necessary) into a buffer of your own. This
+	* doesn't allocate or modify this JSValue, so it is safe to call from several threads at once.
+	*
+	* @param	buffer	The buffer to write to, the result is truncated to fit and is always null-terminated.
+	*
+	* @param	bufferSize	The size of the buffer in bytes (may be 0, to measure the result).
+	*
+	* @return	The length of the whole result, excluding the null-terminator. If this is not
+	*			less than 'bufferSize', the result was truncated.
+	*/
+	size_t toString(char* buffer, size_t bufferSize) const;
+
 	/// Returns this JSValue as an integer (converting if necessary).
 	int toInteger() const;
 
@@ -120,16 +258,84 @@ public:
 
 	/// Returns this JSValue as a boolean (converting if necessary).
 	bool toBoolean() const;
+
+	/// Returns the elements of this array, or an empty array if this JSValue isn't one.
+	const Array& getArray() const;
+
+	/// Returns the elements of this array for modification, turning this JSValue into an empty array first if it isn't one.
+	Array& getArray();
+
+	/// Returns the properties of this object, or an empty object if this JSValue isn't one.
+	const Object& getObject() const;
+
+	/// Returns the properties of this object for modification, turning this JSValue into an empty object first if it isn't one.
+	Object& getObject();
+
+	/// Returns this buffer (sharing its bytes), or an empty buffer if this JSValue isn't one.
+	JSBuffer getBuffer() const;
+
+protected:
+	void release();
 };
 
 typedef std::vector<JSValue> JSArguments;
 
+/**
+* JSError describes why some Javascript failed, see FutureJSValue::getError.
+*/
+struct _OSMExport JSError
+{
+	/// The description of the error, or an empty string if there was no error.
+	std::string message;
+
+	/// The line that the error occurred on, or 0 if it is unknown.
+	int line;
+
+	/// The URL of the script that the error occurred in, if it is known.
+	std::string source;
+
+	JSError() : line(0) {}
+	JSError(const std::string& message, int line = 0, const std::string& source = "") : message(message), line(line), source(source) {}
+
+	/// Returns whether or not this describes an error.
+	bool isError() const { return !message.empty(); }
+};
+
+/**
+* FutureJSValueHandler is an interface that receives the value of a FutureJSValue
+* once it has been computed, see FutureJSValue::then.
+*/
+class _OSMExport FutureJSValueHandler
+{
+public:
+	virtual ~FutureJSValueHandler() {}
+
+	/**
+	* Called from within WebCore::update once the value has been computed.
+	*
+	* @param	value	The computed value (null if the Javascript failed or its WebView was destroyed).
+	*/
+	virtual void onResolve(const JSValue& value) = 0;
+
+	/**
+	* Called from within WebCore::update instead of FutureJSValueHandler::onResolve if the Javascript
+	* failed (for example, because it threw an exception). By default, this resolves the value as null.
+	*
+	* @param	error	Why the Javascript failed.
+	*/
+	virtual void onError(const JSError& error) { onResolve(JSValue()); }
+};
+
 /**
 * FutureJSValue is a special wrapper around a JSValue that allows
 * asynchronous retrieval of the actual value at a later time.
 *
 * If you are unfamiliar with the concept of a 'Future', please see:
 * <http://en.wikipedia.org/wiki/Futures_and_promises>
+*
+* Copies of a FutureJSValue share one request, which is consumed by the first copy to retrieve
+* the value (or to pass it to FutureJSValue::then). Copies that are waiting on it at that moment
+* receive the value too; copies that ask for it afterwards receive a null JSValue.
 */
 class _OSMExport FutureJSValue
 {
@@ -143,16 +349,92 @@ public:
 	*/
 	const JSValue& get();
 
+	/**
+	* Like FutureJSValue::get, but gives up waiting after a certain time.
+	*
+	* @param	timeoutMilliseconds	The maximum time to wait, 0 doesn't wait at all.
+	*
+	* @return	The computed value, or a null JSValue if it hasn't been computed in time
+	*			(use FutureJSValue::isReady to tell that apart from a null result).
+	*/
+	const JSValue& get(int timeoutMilliseconds);
+
+	/**
+	* Returns whether or not the internal JSValue has been computed (FutureJSValue::get won't block).
+	*/
+	bool isReady() const;
+
+	/**
+	* Hands the value over to a handler instead of waiting for it: the handler is called
+	* from within WebCore::update once the value has been computed. If the WebView is destroyed
+	* first, FutureJSValueHandler::onError is called instead.
+	*
+	* @param	handler	The handler to call, it must stay alive until it has been called. After this,
+	*					FutureJSValue::get no longer returns the value.
+	*/
+	void then(FutureJSValueHandler* handler);
+
+	/**
+	* Returns whether or not the Javascript failed (for example, because it threw an exception).
+	* This is only known once the value has been retrieved via FutureJSValue::get.
+	*/
+	bool hasError() const;
+
+	/**
+	* Returns why the Javascript failed: the message, line and source of the error that it raised.
+	* Errors are attributed to the request that raised them, other requests aren't affected.
+	* This is only known once the value has been retrieved via FutureJSValue::get.
+	*/
+	const JSError& getError() const;
+
 protected:
 	void init(WebView* source, int requestID);
 
 	JSValue value;
+	JSError error;
 	WebView* source;
 	int requestID;
 
 	friend class WebView;
 };
 
+/**
+* JSFunction is a handle to a Javascript function that has been compiled once via
+* WebView::compileFunction, so that it may be invoked many times without being parsed again.
+*
+* Handles are invalidated automatically when the page (or the frame that the function was
+* compiled in) navigates; invoking an invalid handle results in a FutureJSValue with an error.
+*/
+class _OSMExport JSFunction
+{
+public:
+	JSFunction();
+
+	/**
+	* Calls the function asynchronously. The arguments are passed as native values, no
+	* Javascript source is built or parsed.
+	*
+	* @param	args	The arguments to pass to the function.
+	*
+	* @return	Returns a 'FutureJSValue' which is a wrapper around the result of the call.
+	*/
+	FutureJSValue invoke(const JSArguments& args = JSArguments());
+
+	/**
+	* Releases the compiled function before the page navigates. This applies to all copies
+	* of this handle, none of them should be invoked afterwards.
+	*/
+	void release();
+
+protected:
+	void init(WebView* source, int functionID);
+
+	WebView* source;
+	int functionID;
+
+	friend class WebView;
+};
+
 }
 
 #endif
@@ -40,9 +40,14 @@
 #   endif
 #endif
 
+namespace Awesomium { struct ThreadOptions; }
+
 namespace Impl {
 void initCommandLine();
 void initWebCorePlatform();
+
+// Applies the affinity and priority in 'options' to the calling thread
+void applyThreadOptions(const Awesomium::ThreadOptions& options);
 }
 
 #endif
@@ -9,6 +9,7 @@
 
 class GURL;
 class URLRequestContext;
+namespace Awesomium { struct ThreadOptions; class ThreadObserver; }
 
 class SimpleResourceLoaderBridge {
 public:
@@ -26,6 +27,11 @@ public:
 	
 	// Call this function to shutdown the simple resource loader bridge.
 	static void Shutdown();
+
+	// xAJS begin:
+	// Sets the options of the IO thread, must be called before it has been started
+	static void SetIOThreadOptions(const Awesomium::ThreadOptions& options, Awesomium::ThreadObserver* observer);
+	// xAJS end
 	
 	// May only be called after Init.
 	static void SetCookie(
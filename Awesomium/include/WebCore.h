@@ -33,12 +33,14 @@
 #include <string>
 
 namespace base { class Thread; class AtExitManager; }
+class MessageLoop;
 class WebCoreProxy;
 class WebViewEvent;
 class WindowlessPlugin;
 class NamedCallback;
 std::string GetDataResource(int id);
 class Lock;
+class ConditionVariable;
 
 namespace Awesomium {
 
@@ -61,9 +63,103 @@ enum PixelFormat
 	PF_RGBA		// RGBA byte ordering [Red, Green, Blue, Alpha]
 };
 
+/**
+* An enumeration of the scheduling priorities for the internal threads, used with ThreadOptions.
+*/
+enum ThreadPriority
+{
+	TP_LOWEST,
+	TP_BELOW_NORMAL,
+	TP_NORMAL,
+	TP_ABOVE_NORMAL,
+	TP_HIGHEST
+};
+
+/**
+* Options for one of the internal threads of the WebCore (the core thread or the IO thread).
+*/
+struct _OSMExport ThreadOptions
+{
+	/// Bit N allows the thread to run on CPU N, 0 (the default) leaves the affinity alone.
+	/// Not supported on Mac OSX, which has no affinity masks.
+	unsigned long long affinityMask;
+
+	/// The scheduling priority (the default is TP_NORMAL). On Linux this is mapped to a nice value.
+	ThreadPriority priority;
+
+	/// The stack size in bytes, 0 (the default) uses the platform's default.
+	int stackSize;
+
+	ThreadOptions();
+};
+
+/**
+* Receives notifications about the internal threads of the WebCore, useful for registering
+* them with external tools (profilers, CPU pinning on NUMA machines, etc).
+*
+* @note	These are called on the thread in question, not on the thread that created the WebCore.
+*/
+class _OSMExport ThreadObserver
+{
+public:
+	virtual ~ThreadObserver() {}
+
+	/**
+	* Called when an internal thread has started, after its ThreadOptions have been applied.
+	*
+	* @param	threadName	The name of the thread ("CoreThread" or "IOThread").
+	*
+	* @param	threadID	The platform's ID of the thread (the Win32 thread ID, or the Linux TID).
+	*/
+	virtual void onThreadStarted(const std::string& threadName, int threadID) = 0;
+
+	/**
+	* Called when an internal thread is about to stop.
+	*/
+	virtual void onThreadStopping(const std::string& threadName, int threadID) = 0;
+};
+
+/**
+* Something that is waiting for a WebView to reach a certain state, see WebCore::addWaiter
+* and the coroutine awaitables in WebViewAwaitables.h.
+*/
+class _OSMExport Waiter
+{
+public:
+	virtual ~Waiter() {}
+
+	/**
+	* Polled at the end of every WebCore::update, should return true once the awaited state has been reached.
+	*/
+	virtual bool isReady() = 0;
+
+	/**
+	* Called once, after isReady has returned true. The Waiter has been removed from the WebCore by then.
+	*/
+	virtual void resume() = 0;
+};
+
+/**
+* Decides where ready Waiters are resumed, see WebCore::setWaiterExecutor.
+*/
+class _OSMExport WaiterExecutor
+{
+public:
+	virtual ~WaiterExecutor() {}
+
+	/**
+	* Should call Waiter::resume, on any thread, at some point.
+	*/
+	virtual void execute(Waiter* waiter) = 0;
+};
+
 /**
 * The WebCore singleton manages the creation of WebViews, the internal worker thread,
 * and various other global states that are required to embed Chromium.
+*
+* WebViews may be created, driven and destroyed from any thread, each WebView should
+* only be used by one thread at a time. Events are only dispatched on the thread that
+* created the WebCore, which is the only thread that may call WebCore::update.
 */
 class _OSMExport WebCore
 {
@@ -77,8 +173,25 @@ public:
 	* @param	enablePlugins	Whether or not to enable embedded plugins.
 	*
 	* @param	pixelFormat		The pixel-format/byte-ordering to use when rendering WebViews.
+	*
+	* @param	enableSingleThreaded	Whether or not to run WebKit on the calling thread instead of on an
+	*									internal core thread, see the note below.
+	*
+	* @param	coreThreadOptions	The CPU affinity, priority and stack size of the core thread (ignored in single-threaded mode).
+	*
+	* @param	ioThreadOptions		The CPU affinity, priority and stack size of the IO thread (which does all networking).
+	*
+	* @param	threadObserver	Optional, is notified when the internal threads start and stop. It must outlive the WebCore.
+	*
+	* @note	In single-threaded mode no core thread is created: all work is done from within WebCore::update
+	*		and calls that would otherwise wait on the core thread (such as WebView::resize, synchronous
+	*		WebView::render, WebView::getContentAsText and FutureJSValue::get) are executed inline. All
+	*		WebCore and WebView calls must then be made from the thread that created the WebCore, and that
+	*		thread is expected to pump its own native message queue (window messages are not pumped for plugins).
 	*/
-	WebCore(LogLevel level = LOG_NORMAL, bool enablePlugins = true, PixelFormat pixelFormat = PF_BGRA);
+	WebCore(LogLevel level = LOG_NORMAL, bool enablePlugins = true, PixelFormat pixelFormat = PF_BGRA, bool enableSingleThreaded = false,
+		const ThreadOptions& coreThreadOptions = ThreadOptions(), const ThreadOptions& ioThreadOptions = ThreadOptions(),
+		ThreadObserver* threadObserver = 0);
 
 	/**
 	* Destroys the WebCore singleton. (Also destroys any lingering WebViews)
@@ -143,8 +256,35 @@ public:
 	/**
 	* Updates the WebCore and allows it to conduct various operations such as the propagation
 	* of bound JS callbacks and the invocation of any queued listener events.
+	*
+	* @note	This must be called from the thread that created the WebCore, it pumps that thread's message loop.
+	*
+	* @param	maxMicroseconds	Optional, the time budget for this update. Listener events are dispatched
+	*							by class (load and navigation events first, then callbacks, then tooltip,
+	*							cursor and target-URL changes) until the budget runs out; the remainder is
+	*							carried over to the next update. Pass 0 (the default) to dispatch everything.
+	*
+	* @return	Returns the number of listener events that are still waiting to be dispatched.
 	*/
-	void update();
+	int update(int maxMicroseconds = 0);
+
+	/**
+	* Registers a Waiter, it will be polled at the end of each WebCore::update and resumed once it is ready.
+	*
+	* @param	waiter	The Waiter to register. It must stay alive until it has been resumed or removed.
+	*/
+	void addWaiter(Waiter* waiter);
+
+	/**
+	* Unregisters a Waiter that hasn't been resumed yet.
+	*/
+	void removeWaiter(Waiter* waiter);
+
+	/**
+	* Sets where ready Waiters are resumed. By default (or when this is set to 0), they
+	* are resumed by WebCore::update on the thread that calls it.
+	*/
+	void setWaiterExecutor(WaiterExecutor* executor);
 
 	/**
 	* Retrieves the base directory.
@@ -162,10 +302,26 @@ public:
 	* Returns whether or not plugins are enabled.
 	*/
 	bool arePluginsEnabled() const;
+
+	/**
+	* Returns whether or not WebKit runs on the calling thread (see the WebCore constructor).
+	*/
+	bool isSingleThreaded() const;
+
+	/**
+	* Retrieves the number of times the core thread has been woken up to do work (to run WebView
+	* commands, render asynchronously, pump plugin messages, etc.) since the WebCore was created.
+	*
+	* @note	Sample this periodically to derive the number of wakeups per second; an idle WebCore
+	*		(no dirty WebViews, no plugins) should not wake up at all.
+	*/
+	int getNumCoreWakeups() const;
 	
 	/**
 	* Pauses the internal thread of the Awesomium WebCore.
 	* 
+	* @note	This has no effect in single-threaded mode.
+	*
 	* @note	The pause and resume functions were added as
 	*		a temporary workaround for threading issues with
 	*		Flash plugins on the Mac OSX platform. You should
@@ -184,32 +340,55 @@ public:
 
 	friend class WebView;
 	friend class FutureJSValue;
+	friend class JSFunction;
 	friend class ::WebCoreProxy;
 	friend class ::WebViewProxy;
 	friend class ::NamedCallback;
 	friend class ::WindowlessPlugin;
+	friend class AwaitableBase;
 	friend std::string GetDataResource(int id);
 
 protected:
 	static WebCore* instance;
 	base::Thread* coreThread;
+	MessageLoop* coreLoop;
 	WebCoreProxy* coreProxy;
 	base::AtExitManager* atExitMgr;
-	std::vector<WebView*> views;
+	static const int kNumViewShards = 16;
+	std::vector<WebView*> viewShards[kNumViewShards]; // the registry of live WebViews, sharded by address
+	Lock* viewShardLocks[kNumViewShards];
+	ConditionVariable* viewShardConditions[kNumViewShards]; // signalled when a WebView of the shard is unpinned
+	const int updateThreadID; // the thread that created us, the only one that runs WebCore::update
+	std::vector<WebView*> dispatchStack; // the WebViews whose events are being run by (re-entrant) updates, 0 once destroyed
+	std::vector<Waiter*> waiters;
+	WaiterExecutor* waiterExecutor;
 	std::deque<WebViewEvent*> eventQueue; // treat as std::queue, missing swap().
+	std::deque<WebViewEvent*> pendingEvents[3]; // indexed by WebViewEvent::Priority, guarded by eventQueueLock
 	std::map<int, std::string> customResponsePageMap;
 	std::string baseDirectory;
 	bool logOpen;
 	bool pluginsEnabled;
 	const PixelFormat pixelFormat;
-	Lock *eventQueueLock, *baseDirLock, *customResponsePageLock;
+	const bool singleThreaded;
+	Lock *eventQueueLock, *baseDirLock, *customResponsePageLock, *waiterLock;
 
 	void queueEvent(WebViewEvent* event);
+	void resumeReadyWaiters();
 	void removeWebView(WebView* view);
+	void purgeWebViewEvents(WebView* view);
+	bool pinWebView(WebView* view);
+	void unpinWebView(WebView* view);
+	bool beginDispatch(WebView* view);
+	void endDispatch();
+	int getViewShard(WebView* view) const;
 
 	void purgePluginMessages();
+	void pluginCreated();
+	void pluginDestroyed();
 
-	void resolveJSValueFuture(WebView* view, int requestID, JSValue* result);
+	bool resolveJSValueFuture(WebView* view, int requestID, JSValue* result, JSError* error, int timeoutMilliseconds);
+	bool isJSValueFutureResolved(WebView* view, int requestID);
+	void setJSValueFutureHandler(WebView* view, int requestID, FutureJSValueHandler* handler);
 
 	void getCustomResponsePage(int statusCode, std::string& filePathResult);
 };
@@ -27,6 +27,7 @@
 #define __WEBCOREPROXY_H__
 
 #include "base/ref_counted.h"
+#include "base/atomicops.h"
 #include "base/timer.h"
 #include "webkit/glue/webkit_glue.h"
 #include "webkit/glue/webkitclient_impl.h"
@@ -36,17 +37,20 @@
 #include "WebURL.h"
 #include "webkit/glue/simple_webmimeregistry_impl.h"
 #include "base/waitable_event.h"
+#include "base/lock.h"
 #include <string>
 #include <list>
+#include <vector>
 
-namespace base { class Thread; }
+class MessageLoop;
+class WebViewProxy;
 namespace Awesomium { class WebCore; }
 
 class WebCoreProxy : public base::RefCountedThreadSafe<WebCoreProxy>,
 	public webkit_glue::WebKitClientImpl
 {
 public:
-	WebCoreProxy(base::Thread* coreThread, bool pluginsEnabled);
+	WebCoreProxy(MessageLoop* coreLoop, bool pluginsEnabled, bool sharesHostThread);
 
 	void startup();
 
@@ -55,6 +59,14 @@ public:
 	void pause();
 	void resume();
 
+	void addPlugin();
+	void removePlugin();
+
+	void countWakeup();
+	int getNumWakeups();
+
+	void scheduleView(WebViewProxy* view);
+
 	bool sandboxEnabled();
 	
 	WebKit::WebMimeRegistry* mimeRegistry();
@@ -88,6 +100,8 @@ protected:
 	
 	void asyncPause();
 
+	void runScheduledViews();
+
 	void pumpPluginMessages();
 	void pumpThrottledMessages();
 	void purgePluginMessages();
@@ -95,9 +109,16 @@ protected:
 	class Clipboard;
 	Clipboard *webclipboard;
 
-	base::Thread* coreThread;
+	MessageLoop* coreLoop;
 	bool pluginsEnabled;
+	bool sharesHostThread; // See WebCore's single-threaded mode
 	base::RepeatingTimer<WebCoreProxy> pluginMessageTimer;
+	int numPlugins;
+	base::subtle::Atomic32 numWakeups;
+	Lock schedulerLock;
+	std::vector<WebViewProxy*> readyViews;
+	int64 schedulerVirtualTime;
+	bool isSchedulerPending;
 	webkit_glue::SimpleWebMimeRegistryImpl mime_registry_;
 	base::WaitableEvent threadWaitEvent, pauseRequestEvent;
 
@@ -28,6 +28,20 @@
 
 #include "WebViewListener.h"
 #include <map>
+#include <vector>
+
+// Whether or not the standard library has std::function, WebView::setCallback accepts one when it does
+#if !defined(AWESOMIUM_HAS_STD_FUNCTION)
+#	if (defined(_MSC_VER) && _MSC_VER >= 1600) || (defined(__cplusplus) && __cplusplus >= 201103L) || defined(__GXX_EXPERIMENTAL_CXX0X__)
+#		define AWESOMIUM_HAS_STD_FUNCTION 1
+#	else
+#		define AWESOMIUM_HAS_STD_FUNCTION 0
+#	endif
+#endif
+
+#if AWESOMIUM_HAS_STD_FUNCTION
+#include <functional>
+#endif
 
 #if defined(_WIN32)
 #include <windows.h>
@@ -39,14 +53,27 @@ class NSEvent;
 class WebViewWaitState;
 class WebViewProxy;
 class JSValueFutureImpl;
-class FutureValueCallback;
-class CheckKeyboardFocusCallback;
-namespace base { class Thread; }
+class MessageLoop;
 class LockImpl;
-namespace WebViewEvents { class InvokeCallback; }
+struct WebViewCommand;
+namespace WebViewEvents { class InvokeCallback; class FinishLoad; }
 
 namespace Awesomium {
 
+#if AWESOMIUM_HAS_STD_FUNCTION
+/**
+* Adapts a std::function to the CallbackHandler interface, see WebView::setCallback.
+*/
+class FunctionCallbackHandler : public CallbackHandler
+{
+	std::function<void(const JSArguments&)> function;
+public:
+	FunctionCallbackHandler(const std::function<void(const JSArguments&)>& function) : function(function) {}
+
+	void handleCallback(WebView* caller, const std::string& name, const JSArguments& args) { function(args); }
+};
+#endif
+
 class WebCore;
 
 /**
@@ -79,6 +106,113 @@ struct _OSMExport Rect {
 	bool isEmpty() const;
 };
 
+/**
+* Scheduling priorities, used with WebView::setPriority. When several WebViews have work
+* pending on the core thread, each receives a share of its time proportional to its priority.
+*/
+enum WebViewPriority {
+	VIEW_PRIORITY_FOREGROUND,	// The view the user is interacting with (weight 8)
+	VIEW_PRIORITY_VISIBLE,		// A view that is on-screen (weight 4)
+	VIEW_PRIORITY_BACKGROUND	// A view that is hidden or off-screen (weight 1)
+};
+
+/**
+* What to do when a WebView's command queue is full, used with WebView::setCommandQueueLimit.
+*
+* Commands that the caller waits on (such as WebView::resize or synchronous WebView::render), as well
+* as startup, shutdown, input and WebView::requestContentAsText, are never dropped; they always block.
+*/
+enum CommandQueuePolicy {
+	QUEUE_POLICY_BLOCK,			// Wait until the core thread has made room (the default)
+	QUEUE_POLICY_DROP_OLDEST,	// Discard the oldest queued command to make room
+	QUEUE_POLICY_COALESCE,		// Replace the newest queued command if it sets the same state for the same target, otherwise wait
+	QUEUE_POLICY_FAIL			// Discard the new command
+};
+
+/**
+* How the invocations of a 'Client' callback are delivered, used with WebView::setCallbackPolicy.
+* The policy is applied on the core thread, before any event is queued.
+*/
+enum CallbackPolicy {
+	CALLBACK_POLICY_DELIVER_ALL,		// Deliver every invocation (the default)
+	CALLBACK_POLICY_COALESCE_LATEST,	// Deliver at most one invocation per WebCore::update, with the latest arguments
+	CALLBACK_POLICY_RATE_LIMIT,			// Deliver at most a certain number of invocations per second, discard the rest
+	CALLBACK_POLICY_ACCUMULATE			// Deliver all invocations since the last WebCore::update at once; each argument
+										// is then an array holding the arguments of one invocation, in order
+};
+
+/**
+* Text encodings, used with WebView::requestContentAsText
+*/
+enum TextEncoding {
+	TEXT_ENCODING_WIDE,
+	TEXT_ENCODING_UTF8,
+	TEXT_ENCODING_UTF16
+};
+
+/**
+* ContentTextHandler is a virtual interface that receives the text retrieved via
+* WebView::requestContentAsText. Only the chunk method that matches the requested
+* encoding is called, all calls are made from within WebCore::update.
+*/
+class _OSMExport ContentTextHandler
+{
+public:
+	virtual ~ContentTextHandler() {}
+
+	/**
+	* This event is fired for each chunk of text when TEXT_ENCODING_WIDE was requested.
+	*/
+	virtual void onContentText(const std::wstring& text) {}
+
+	/**
+	* This event is fired for each chunk of text when TEXT_ENCODING_UTF8 was requested.
+	*/
+	virtual void onContentTextUTF8(const std::string& text) {}
+
+	/**
+	* This event is fired for each chunk of text when TEXT_ENCODING_UTF16 was requested.
+	*
+	* @param	text	The UTF-16 code units of this chunk (not null-terminated).
+	* @param	length	The number of code units in this chunk.
+	*/
+	virtual void onContentTextUTF16(const unsigned short* text, int length) {}
+
+	/**
+	* This event is fired once after the last chunk has been delivered.
+	*
+	* @param	totalLength	The total number of UTF-16 code units that were retrieved.
+	*/
+	virtual void onFinishContentText(int totalLength) = 0;
+};
+
+/**
+* Various counters gathered by a WebView, see WebView::getStats.
+*/
+struct _OSMExport WebViewStats {
+	/// The total number of input events that have been injected.
+	int numInputEventsInjected;
+
+	/// The number of injected input events that were merged into a previous event (consecutive
+	/// mouse-moves collapse to the latest position and consecutive mouse-wheels are summed).
+	int numInputEventsCoalesced;
+
+	/// The number of times the core thread has picked this WebView to run its queued commands.
+	int numScheduledSlices;
+
+	/// The average and worst time, in microseconds, that this WebView's commands waited to be picked.
+	int averageQueueDelayMicroseconds;
+	int maxQueueDelayMicroseconds;
+
+	/// The number of commands that were discarded because the command queue was full (see CommandQueuePolicy).
+	int numCommandsDropped;
+
+	/// The greatest number of commands that have been waiting in the command queue at once.
+	int commandQueueHighWater;
+
+	WebViewStats();
+};
+
 /**
 * A WebView is essentially a single instance of a web-browser (created via the WebCore singleton)
 * that you can interact with (via input injection, javascript, etc.) and render to an off-screen buffer.
@@ -110,6 +244,37 @@ public:
 	*/
 	WebViewListener* getListener();
 
+	/**
+	* Registers a ConsoleMessageHandler to receive the messages that the page writes to the console (including
+	* uncaught Javascript errors), in batches.
+	*
+	* @param	handler	The ConsoleMessageHandler to register. Or, you can pass '0' to undo any current registrations.
+	*/
+	void setConsoleMessageHandler(ConsoleMessageHandler* handler);
+
+	/**
+	* Retrieves the current ConsoleMessageHandler.
+	*
+	* @return	If a ConsoleMessageHandler is registered, returns a pointer to the instance, otherwise returns 0.
+	*/
+	ConsoleMessageHandler* getConsoleMessageHandler();
+
+	/**
+	* Begins recording a batch of commands. All calls made to this WebView until the matching
+	* call to WebView::endBatch are recorded into the command queue and then submitted to the core
+	* thread all at once, where they are replayed back-to-back.
+	*
+	* @note	Batches may be nested; the commands are submitted when the outermost batch ends.
+	*		Calls that must wait on the core thread (such as WebView::resize, synchronous WebView::render,
+	*		WebView::getContentAsText and FutureJSValue::get) submit the commands recorded so far first.
+	*/
+	void beginBatch();
+
+	/**
+	* Ends a batch of commands that was started with WebView::beginBatch and submits it.
+	*/
+	void endBatch();
+
 	/**
 	* Loads a URL into the WebView asynchronously.
 	*
@@ -181,10 +346,38 @@ public:
 	* @param	frameName	Optional, the name of the frame to execute in; leave this blank to execute in the main frame.
 	*
 	* @return	Returns a 'FutureJSValue' which is basically an 'IOU' for the future JSValue result.
-	*			You can obtain the actual result via FutureJSValue::get later.
+	*			You can obtain the actual result via FutureJSValue::get later. Arrays and plain objects
+	*			are converted; functions, DOM objects and repeated references to an object become null.
 	*/
 	Awesomium::FutureJSValue executeJavascriptWithResult(const std::string& javascript, const std::wstring& frameName = L"");
 
+	/**
+	* Evaluates several Javascript expressions in the context of the current page asynchronously, all
+	* at once: they are run by a single task on the core thread, within a single script.
+	*
+	* @param	expressions	The Javascript expressions to evaluate, in order.
+	*
+	* @param	frameName	Optional, the name of the frame to evaluate in; leave this blank to evaluate in the main frame.
+	*
+	* @return	Returns a 'FutureJSValue' for each expression, in the same order. An expression that throws
+	*			doesn't affect the others, its error is reported by FutureJSValue::getError.
+	*/
+	std::vector<Awesomium::FutureJSValue> evaluateBatch(const std::vector<std::string>& expressions, const std::wstring& frameName = L"");
+
+	/**
+	* Compiles a Javascript function in the context of the current page asynchronously, so that it may be
+	* invoked many times without building and parsing a new script for each call.
+	*
+	* @param	source	The Javascript expression that evaluates to the function, for example:
+	*					"function(a, b) { return a + b; }"
+	*
+	* @param	frameName	Optional, the name of the frame to compile in; leave this blank to compile in the main frame.
+	*
+	* @return	Returns a handle to the compiled function, see JSFunction::invoke. The handle is invalidated
+	*			when the frame navigates.
+	*/
+	Awesomium::JSFunction compileFunction(const std::string& source, const std::wstring& frameName = L"");
+
 	/**
 	* Sets a global 'Client' property that can be accessed via Javascript from
 	* within all pages loaded into this web-view.
@@ -210,6 +403,73 @@ public:
 	*/
 	void setCallback(const std::string& name);
 
+	/**
+	* Registers a global 'Client' callback that is answered synchronously: the handler is called
+	* on the core thread, from within the Javascript call, and its result is returned to the page.
+	* WebViewListener::onCallback is not called for this callback.
+	*
+	* @param	name	The name of the callback. You can invoke the callback in Javascript
+	*					as: var result = Client.your_name_here(arg1, arg2, ...);
+	*
+	* @param	handler	The handler to call, please read the rules in CoreThreadCallback's documentation.
+	*					Pass 0 to go back to asynchronous notification via WebViewListener::onCallback.
+	*/
+	void setCallback(const std::string& name, CoreThreadCallback* handler);
+
+	/**
+	* Registers a global 'Client' callback whose invocations go straight to a handler of its own
+	* (called from within WebCore::update), instead of WebViewListener::onCallback.
+	*
+	* @param	name	The name of the callback. You can invoke the callback in Javascript
+	*					as: Client.your_name_here(arg1, arg2, ...);
+	*
+	* @param	handler	The handler to call, it must stay alive for as long as this WebView does.
+	*
+	* @note	To go back to WebViewListener::onCallback, call WebView::setCallback(name).
+	*/
+	void setCallback(const std::string& name, CallbackHandler* handler);
+
+#if AWESOMIUM_HAS_STD_FUNCTION
+	/**
+	* Registers a global 'Client' callback whose invocations go straight to a function
+	* (called from within WebCore::update), instead of WebViewListener::onCallback.
+	*
+	* @param	name	The name of the callback. You can invoke the callback in Javascript
+	*					as: Client.your_name_here(arg1, arg2, ...);
+	*
+	* @param	handler	The function to call, it is copied and kept for as long as this WebView lives.
+	*/
+	void setCallback(const std::string& name, const std::function<void(const JSArguments&)>& handler)
+	{
+		registerCallback(name, 0, new FunctionCallbackHandler(handler), true);
+	}
+#endif
+
+	/**
+	* Sets how the invocations of a 'Client' callback are delivered, which is useful for callbacks
+	* that a page invokes very frequently (for example, on every animation frame). This has no
+	* effect on callbacks that are answered on the core thread (see CoreThreadCallback).
+	*
+	* @param	name	The name of the callback, it is registered if it hasn't been already.
+	*
+	* @param	policy	The policy to use, see CallbackPolicy.
+	*
+	* @param	maxPerSecond	The number of invocations delivered per second, for CALLBACK_POLICY_RATE_LIMIT.
+	*							A value of 0 (or less) means unlimited.
+	*/
+	void setCallbackPolicy(const std::string& name, Awesomium::CallbackPolicy policy, int maxPerSecond = 0);
+
+	/**
+	* Sets whether or not the string arguments of a 'Client' callback are binary data, in which case
+	* they are decoded directly into a JSBuffer (see JSValue::isBuffer) instead of a string.
+	*
+	* @param	name	The name of the callback, it is registered if it hasn't been already.
+	*
+	* @param	receivesBuffers	Whether or not string arguments should be received as buffers. Each character
+	*							(with a code from 0 to 255) is one byte, see JSBuffer.
+	*/
+	void setCallbackReceivesBuffers(const std::string& name, bool receivesBuffers);
+
 	/**
 	* Returns whether or not the current web-view is dirty and needs to be re-rendered.
 	*
@@ -234,11 +494,43 @@ public:
 	*/
 	void render(unsigned char* destination, int destRowSpan, int destDepth, Awesomium::Rect* renderedRect = 0);
 
+	/**
+	* Asks the core thread to render the WebView in the background and returns immediately.
+	* The result can be collected later with WebView::tryGetRenderedFrame, which lets the caller
+	* overlap its own work with WebKit's layout and painting.
+	*
+	* @note	This has no effect if asynchronous rendering is enabled (rendering is already continuous).
+	*		A typical pattern is to call requestRender at the end of one frame and collect it with
+	*		tryGetRenderedFrame during the next; the result is deterministically one frame behind.
+	*/
+	void requestRender();
+
+	/**
+	* Copies the frame that was rendered in response to WebView::requestRender, if it has finished.
+	*
+	* @param	destination	The buffer to render to, its width and height should match the WebView's.
+	*
+	* @param	destRowSpan	The row-span of the destination buffer (number of bytes per row).
+	*
+	* @param	destDepth	The depth (bytes per pixel) of the destination buffer. Valid options
+	*						include 3 (BGR/RGB) or 4 (BGRA/RGBA).
+	*
+	* @param	renderedRect	Optional (pass 0 to ignore); if asynchronous rendering is not enabled,
+	*							a pointer to a Rect to store the area that changed since the last
+	*							frame that was collected.
+	*
+	* @return	Returns true if a new frame was copied to the destination, otherwise returns false
+	*			and leaves the destination untouched.
+	*/
+	bool tryGetRenderedFrame(unsigned char* destination, int destRowSpan, int destDepth, Awesomium::Rect* renderedRect = 0);
+
 	/**
 	* Injects a mouse-move event in local coordinates.
 	*
 	* @param	x	The absolute x-coordinate of the mouse (localized to the WebView).
 	* @param	y	The absolute y-coordinate of the mouse (localized to the WebView).
+	*
+	* @note	Consecutive mouse-moves that have not yet been dispatched are collapsed to the latest position.
 	*/
 	void injectMouseMove(int x, int y);
 
@@ -261,6 +553,8 @@ public:
 	*
 	* @param	scrollAmountY	The amount of pixels to scroll by in the Y axis.
 	* @param	scrollAmountX	The amount of pixels to scroll by in the X axis.
+	*
+	* @note	Consecutive mouse-wheels that have not yet been dispatched are summed into a single event.
 	*/
 	void injectMouseWheelXY(int scrollAmountX, int scrollAmountY);
 
@@ -357,6 +651,23 @@ public:
 	*/
 	void getContentAsText(std::wstring& result, int maxChars);
 
+	/**
+	* Retrieves the content of the current page as plain text without blocking the calling thread.
+	*
+	* @param	handler	The ContentTextHandler to deliver the text to, it must remain valid
+	*					until ContentTextHandler::onFinishContentText has been called.
+	*
+	* @param	maxChars	The maximum number of characters to retrieve.
+	*
+	* @param	encoding	The encoding to deliver the text in; TEXT_ENCODING_UTF16 is the native
+	*						encoding of WebKit and requires no conversion.
+	*
+	* @param	chunkSize	Optional, the maximum number of UTF-16 code units per chunk. When non-zero,
+	*						the text is converted and delivered over several passes of the core
+	*						thread so that other work can interleave. Pass 0 to receive it in one chunk.
+	*/
+	void requestContentAsText(Awesomium::ContentTextHandler* handler, int maxChars, Awesomium::TextEncoding encoding = TEXT_ENCODING_WIDE, int chunkSize = 0);
+
 	/**
 	* Zooms into the page, enlarging by 20%.
 	*/
@@ -386,7 +697,7 @@ public:
 	void unfocus();
 
 	/**
-	* Notifies the current page that is has gained focus.
+	* Notifies the current page that it has gained focus.
 	*/
 	void focus();
 
@@ -397,11 +708,43 @@ public:
 	*/
 	void setTransparent(bool isTransparent);
 
+	/**
+	* Sets the scheduling priority of this WebView (the default is VIEW_PRIORITY_VISIBLE).
+	*
+	* @param	priority	The priority to use, see WebViewPriority.
+	*
+	* @note	Input that has been injected into any WebView is always dispatched before other
+	*		queued work, and before the WebView is rendered.
+	*/
+	void setPriority(Awesomium::WebViewPriority priority);
+
+	/**
+	* Limits the number of commands that may wait in this WebView's command queue for the core thread.
+	*
+	* @param	maxDepth	The maximum number of queued commands (the default is 256).
+	*
+	* @param	policy	What to do when a call is made while the queue is full, see CommandQueuePolicy.
+	*/
+	void setCommandQueueLimit(int maxDepth, Awesomium::CommandQueuePolicy policy = QUEUE_POLICY_BLOCK);
+
+	/**
+	* Retrieves the current statistics of this WebView.
+	*
+	* @return	Returns a snapshot of the counters.
+	*/
+	Awesomium::WebViewStats getStats();
+
 protected:
-	WebView(int width, int height, bool isTransparent, bool enableAsyncRendering, int maxAsyncRenderPerSec, base::Thread* coreThread);
+	WebView(int width, int height, bool isTransparent, bool enableAsyncRendering, int maxAsyncRenderPerSec, MessageLoop* coreLoop, bool isCoreInline);
 	~WebView();
 
 	void startup();
+	void registerCallback(const std::string& name, CoreThreadCallback* coreThreadHandler, CallbackHandler* handler, bool isHandlerOwned);
+	::WebViewCommand& beginCommand(int type, const std::string& target = std::string());
+	void endCommand(bool isBlocking = false);
+	void postCommand(int type, bool isBlocking = false);
+	void submitBatch();
+	void postInputFlush();
 	void setDirty(bool val = true);
 	void setAsyncDirty(bool val = true);
 	void setFinishRender();
@@ -409,26 +752,44 @@ protected:
 	void setFinishGetContentText();
 	void setFinishResize();
 
-	void resolveJSValueFuture(int requestID, Awesomium::JSValue* result);
-	void handleFutureJSValueCallback(const Awesomium::JSArguments& args);
-	void nullifyFutureJSValueCallbacks();
+	int createJSValueFutures(int count);
+	int getFutureShard(int requestID) const;
+	Awesomium::FutureJSValue invokeFunction(int functionID, const Awesomium::JSArguments& args);
+	void releaseFunction(int functionID);
+	bool resolveJSValueFuture(int requestID, Awesomium::JSValue* result, Awesomium::JSError* error, int timeoutMilliseconds);
+	void setJSValueFutureHandler(int requestID, Awesomium::FutureJSValueHandler* handler);
+	void pumpUntilResolved(JSValueFutureImpl* futureImpl, LockImpl* lock, int timeoutMilliseconds);
+	void setFutureJSValue(int requestID, const Awesomium::JSValue& value);
+	void setFutureJSError(int requestID, const Awesomium::JSError& error);
+	void resolveFuture(int requestID, const Awesomium::JSValue& value, const Awesomium::JSError& error);
 	void handleCheckKeyboardFocus(bool isFocused);
+	bool isJSValueFutureResolved(int requestID);
 
-	base::Thread* coreThread;
+	MessageLoop* coreLoop;
+	const bool isCoreInline;
 	WebViewProxy* viewProxy;
 	WebViewWaitState* waitState;
 	WebViewListener* listener;
+	ConsoleMessageHandler* consoleMessageHandler;
 	LockImpl* dirtinessLock;
 	bool dirtiness, isKeyboardFocused;
-	LockImpl* jsValueFutureMapLock;
-	std::map<int, JSValueFutureImpl*> jsValueFutureMap;
+	LockImpl* ownedCallbackHandlersLock;
+	std::vector<CallbackHandler*> ownedCallbackHandlers; // never deleted before the WebView, events may still point to them
+	static const int kNumFutureShards = 8;
+	std::map<int, JSValueFutureImpl*> jsValueFutureMaps[kNumFutureShards]; // the pending futures, sharded by request ID
+	LockImpl* jsValueFutureLocks[kNumFutureShards];
+	int batchDepth;
+	int numFinishedLoads; // only touched by the thread that calls WebCore::update
+	int pinCount; // see WebCore::pinWebView, guarded by the WebCore's registry shard lock
+	int dispatchCount; // the number of our events being run by WebCore::update, guarded like pinCount
 
 	const bool enableAsyncRendering;
 
 	friend class WebCore;
+	friend class JSFunction;
+	friend class LoadAwaitable;
+	friend class ::WebViewEvents::FinishLoad;
 	friend class ::WebViewProxy;
-	friend class ::FutureValueCallback;
-	friend class ::CheckKeyboardFocusCallback;
 };
 
 }
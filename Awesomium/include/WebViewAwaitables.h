@@ -0,0 +1,224 @@
+/*
+	This file is a part of Awesomium, a library that makes it easy for 
+	developers to embed web-content in their applications.
+
+	Copyright (C) 2009 Adam J. Simmons
+
+	Project Website:
+	<http://princeofcode.com/awesomium.php>
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 
+	02110-1301 USA
+*/
+
+
+#ifndef __WEBVIEWAWAITABLES_H__
+#define __WEBVIEWAWAITABLES_H__
+
+#include "WebCore.h"
+
+/**
+* C++20 coroutine support. These types are header-only: Awesomium itself is built without
+* coroutines, only the host's translation units that include this file need a C++20 compiler.
+*
+* Example:
+*	Awesomium::JSValue title = co_await Awesomium::evalAsync(view, "document.title");
+*
+* Suspended coroutines are polled and resumed at the end of WebCore::update, on the thread
+* that calls it, or handed to the WaiterExecutor set with WebCore::setWaiterExecutor.
+*/
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+#define AWESOMIUM_HAS_COROUTINES 1
+
+#include <coroutine>
+
+namespace Awesomium {
+
+/**
+* The common part of the awaitables below: registers itself as a Waiter with the WebCore
+* when its coroutine suspends, and resumes the coroutine once it is ready.
+*/
+class AwaitableBase : public Waiter
+{
+public:
+	AwaitableBase(WebView* view) : view(view), isWaiting(false)
+	{
+	}
+
+	AwaitableBase(const AwaitableBase& other) : view(other.view), isWaiting(false)
+	{
+	}
+
+	~AwaitableBase()
+	{
+		// The coroutine was destroyed while it was suspended
+		if(isWaiting)
+			WebCore::Get().removeWaiter(this);
+	}
+
+	bool await_ready()
+	{
+		return isReady();
+	}
+
+	void await_suspend(std::coroutine_handle<> handle)
+	{
+		this->handle = handle;
+		isWaiting = true;
+		WebCore::Get().addWaiter(this);
+	}
+
+	void resume()
+	{
+		isWaiting = false;
+		handle.resume();
+	}
+
+protected:
+	/**
+	* Keeps the WebView from being destroyed until unpinView. Returns false if the WebView
+	* has been destroyed in the meantime, in which case awaiting it resumes right away.
+	*/
+	bool pinView() const
+	{
+		return WebCore::Get().pinWebView(view);
+	}
+
+	void unpinView() const
+	{
+		WebCore::Get().unpinWebView(view);
+	}
+
+	WebView* view;
+	std::coroutine_handle<> handle;
+	bool isWaiting;
+};
+
+/**
+* Resumes at the next WebViewListener::onFinishLoading of a WebView, see Awesomium::loadURLAsync.
+*/
+class LoadAwaitable : public AwaitableBase
+{
+public:
+	LoadAwaitable(WebView* view) : AwaitableBase(view), targetNumLoads(view->numFinishedLoads + 1)
+	{
+	}
+
+	bool isReady()
+	{
+		if(!pinView())
+			return true;
+
+		bool result = view->numFinishedLoads >= targetNumLoads;
+		unpinView();
+
+		return result;
+	}
+
+	void await_resume()
+	{
+	}
+
+protected:
+	int targetNumLoads;
+};
+
+/**
+* Resumes once the result of a Javascript evaluation has arrived, see Awesomium::evalAsync.
+*/
+class EvalAwaitable : public AwaitableBase
+{
+public:
+	EvalAwaitable(WebView* view, const FutureJSValue& future) : AwaitableBase(view), future(future)
+	{
+	}
+
+	bool isReady()
+	{
+		return future.isReady();
+	}
+
+	JSValue await_resume()
+	{
+		// Won't block, the result is already there
+		return future.get();
+	}
+
+protected:
+	FutureJSValue future;
+};
+
+/**
+* Resumes once a WebView has new content to render (see WebView::isDirty), see Awesomium::nextFrame.
+*/
+class FrameAwaitable : public AwaitableBase
+{
+public:
+	FrameAwaitable(WebView* view) : AwaitableBase(view)
+	{
+	}
+
+	bool isReady()
+	{
+		if(!pinView())
+			return true;
+
+		bool result = view->isDirty();
+		unpinView();
+
+		return result;
+	}
+
+	void await_resume()
+	{
+	}
+};
+
+/**
+* Loads a URL into a WebView (see WebView::loadURL) and returns an awaitable that
+* resumes when the load has finished.
+*/
+inline LoadAwaitable loadURLAsync(WebView* view, const std::string& url, const std::wstring& frameName = L"", 
+								  const std::string& username = "", const std::string& password = "")
+{
+	// Take the load count before the load is issued, so that we can't miss it
+	LoadAwaitable awaitable(view);
+	view->loadURL(url, frameName, username, password);
+
+	return awaitable;
+}
+
+/**
+* Evaluates Javascript in a WebView (see WebView::executeJavascriptWithResult) and returns
+* an awaitable that resumes with the result.
+*/
+inline EvalAwaitable evalAsync(WebView* view, const std::string& javascript, const std::wstring& frameName = L"")
+{
+	return EvalAwaitable(view, view->executeJavascriptWithResult(javascript, frameName));
+}
+
+/**
+* Returns an awaitable that resumes once a WebView has new content to render.
+*/
+inline FrameAwaitable nextFrame(WebView* view)
+{
+	return FrameAwaitable(view);
+}
+
+}
+
+#endif
+
+#endif
@@ -0,0 +1,195 @@
+/*
+	This file is a part of Awesomium, a library that makes it easy for 
+	developers to embed web-content in their applications.
+
+	Copyright (C) 2009 Adam J. Simmons
+
+	Project Website:
+	<http://princeofcode.com/awesomium.php>
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 
+	02110-1301 USA
+*/
+
+
+#ifndef __WEBVIEWCOMMAND_H__
+#define __WEBVIEWCOMMAND_H__
+
+#include "WebView.h"
+#include "base/waitable_event.h"
+#include <string>
+#include <vector>
+
+class LockImpl;
+class MessageLoop;
+class WebViewProxy;
+class WebCoreProxy;
+
+/**
+* A command that has been issued via the WebView API and is waiting to be run on the core thread.
+*
+* Commands are tagged structs rather than heap-allocated tasks: they live in the fixed slots of a
+* WebViewCommandQueue and their string members keep their capacity between uses, so issuing a command
+* in the steady state does not allocate.
+*/
+struct WebViewCommand
+{
+	enum Type
+	{
+		STARTUP,
+		SHUTDOWN,
+		LOAD_URL,
+		LOAD_HTML,
+		LOAD_FILE,
+		GO_TO_HISTORY_OFFSET,
+		REFRESH,
+		EXECUTE_JAVASCRIPT,
+		EXECUTE_JAVASCRIPT_WITH_RESULT,
+		EVALUATE_BATCH,
+		COMPILE_FUNCTION,
+		INVOKE_FUNCTION,
+		RELEASE_FUNCTION,
+		SET_PROPERTY,
+		SET_CALLBACK,
+		SET_CALLBACK_POLICY,
+		SET_CALLBACK_RECEIVES_BUFFERS,
+		RENDER_SYNC,
+		REQUEST_RENDER,
+		FLUSH_INPUT,
+		CUT,
+		COPY,
+		PASTE,
+		SELECT_ALL,
+		DESELECT_ALL,
+		GET_CONTENT_AS_TEXT,
+		REQUEST_CONTENT_AS_TEXT,
+		ZOOM_IN,
+		ZOOM_OUT,
+		RESET_ZOOM,
+		RESIZE,
+		SET_TRANSPARENT,
+		SET_FOCUS,
+		SET_PRIORITY
+	};
+
+	Type type;
+	int intArg[3];
+	void* pointerArg[2];
+	std::string stringArg[3];
+	std::vector<std::string> stringList;
+	std::wstring frameName;
+	Awesomium::JSValue value;
+
+	WebViewCommand();
+
+	/**
+	* Returns whether or not commands of this type must always be run (someone waits on them,
+	* or skipping them would leave the WebView in a bad state), regardless of CommandQueuePolicy.
+	*/
+	static bool isEssential(Type type);
+
+	/**
+	* Returns whether or not a command of this type only sets some state, so that a newer one for the same
+	* target (the name in stringArg[0], for the types that have one) supersedes it. See QUEUE_POLICY_COALESCE.
+	*/
+	static bool isCoalescible(Type type);
+
+	/**
+	* Returns whether or not commands of this type are aimed at a target named by stringArg[0].
+	*/
+	static bool hasTarget(Type type);
+
+	/**
+	* Moves the contents of this command into another one. The string buffers are swapped
+	* rather than copied so that neither side loses its capacity.
+	*/
+	void moveTo(WebViewCommand& other);
+};
+
+/**
+* A bounded ring of WebViewCommands with a single consumer (WebViewProxy, on the core thread).
+*
+* The producer fills a slot in-place between beginPush and endPush. Pushed commands may be held
+* back (unpublished) and made visible to the consumer all at once via publish, which is how
+* WebView::beginBatch / WebView::endBatch are implemented. Whenever published commands arrive
+* while the consumer is idle, the consumer is handed to the WebCoreProxy's scheduler (see
+* WebCoreProxy::scheduleView), which runs it on the core thread in turn with other WebViews.
+*
+* The queue holds at most 'maxDepth' commands; what happens to a push beyond that is decided
+* by the Awesomium::CommandQueuePolicy.
+*/
+class WebViewCommandQueue
+{
+public:
+	WebViewCommandQueue(WebViewProxy* consumer, MessageLoop* consumerLoop, WebCoreProxy* scheduler, size_t capacity);
+	~WebViewCommandQueue();
+
+	/**
+	* Reserves the next slot and returns it for the caller to fill. Blocks while the queue is full,
+	* unless the policy allows the push to be dropped or coalesced. Must be followed by a call to endPush.
+	*
+	* @param	target	The name that the command is aimed at, for the types that have one (see WebViewCommand::hasTarget).
+	*/
+	WebViewCommand& beginPush(WebViewCommand::Type type, const std::string& target = std::string());
+
+	/**
+	* Finishes a push that was started with beginPush.
+	*
+	* @param	shouldPublish	Whether or not to make all pushed commands visible to the consumer now.
+	*/
+	void endPush(bool shouldPublish);
+
+	/**
+	* Makes all pushed commands visible to the consumer.
+	*/
+	void publish();
+
+	/**
+	* Moves the oldest published command into 'result'. Called from the consumer only.
+	*
+	* @return	Returns false (and marks the consumer as idle) if there was nothing to pop.
+	*/
+	bool pop(WebViewCommand& result);
+
+	/**
+	* Changes the maximum depth and the overflow policy. Called from the producer only.
+	*/
+	void setLimit(size_t maxDepth, Awesomium::CommandQueuePolicy policy);
+
+	void getStats(int& numDropped, int& highWater);
+
+protected:
+	WebViewProxy* consumer;
+	MessageLoop* consumerLoop;
+	WebCoreProxy* scheduler;
+	std::vector<WebViewCommand> slots;
+	size_t head, numPublished, numUnpublished, maxDepth, highWater;
+	Awesomium::CommandQueuePolicy policy;
+	int numDropped;
+	bool isDrainPending;
+
+	enum PushMode { PUSH_APPEND, PUSH_REPLACE, PUSH_DISCARD };
+	PushMode pushMode;
+	WebViewCommand discardSlot;
+	LockImpl* lock;
+	base::WaitableEvent spaceAvailableEvent;
+
+	bool publishLocked();
+	void scheduleDrain();
+	bool dropOldestLocked();
+	WebViewCommand* findSupersededLocked(WebViewCommand::Type type, const std::string& target);
+};
+
+#endif
@@ -27,15 +27,31 @@
 #define __WEBVIEWEVENT_H__
 
 #include "WebView.h"
+#include "base/string16.h"
+#include "base/ref_counted.h"
+#include "base/lock.h"
 
 class WebViewProxy;
 
 class WebViewEvent
 {
 public:
+	/**
+	* The classes of events, in the order that WebCore::update dispatches them.
+	*/
+	enum Priority
+	{
+		PRIORITY_LOAD,			// Load and navigation progress
+		PRIORITY_CALLBACK,		// Javascript callbacks and other requested results
+		PRIORITY_NOTIFICATION,	// Cosmetic changes (tooltips, cursors, target URLs)
+		NUM_PRIORITIES
+	};
+
 	WebViewEvent(Awesomium::WebView* view);
 	virtual ~WebViewEvent() {}
 	virtual void run() = 0;
+	virtual Priority getPriority() const { return PRIORITY_NOTIFICATION; }
+	Awesomium::WebView* getView() const { return view; }
 protected:
 	Awesomium::WebView* view;
 };
@@ -52,6 +68,7 @@ class BeginLoad : public WebViewEvent
 public:
 	BeginLoad(Awesomium::WebView* view, const std::string& url, const std::wstring& frameName, int statusCode, const std::wstring& mimeType);
 	void run();
+	Priority getPriority() const { return PRIORITY_LOAD; }
 };
 
 class FinishLoad : public WebViewEvent
@@ -59,6 +76,7 @@ class FinishLoad : public WebViewEvent
 public:
 	FinishLoad(Awesomium::WebView* view);
 	void run();
+	Priority getPriority() const { return PRIORITY_LOAD; }
 };
 
 class BeginNavigate : public WebViewEvent
@@ -68,6 +86,7 @@ class BeginNavigate : public WebViewEvent
 public:
 	BeginNavigate(Awesomium::WebView* view, const std::string& url, const std::wstring& frameName);
 	void run();
+	Priority getPriority() const { return PRIORITY_LOAD; }
 };
 
 class ReceiveTitle : public WebViewEvent
@@ -77,14 +96,75 @@ class ReceiveTitle : public WebViewEvent
 public:
 	ReceiveTitle(Awesomium::WebView* view, const std::wstring& title, const std::wstring& frameName);
 	void run();
+	Priority getPriority() const { return PRIORITY_LOAD; }
+};
+
+/**
+* The invocations of a coalesced or accumulated callback that have yet to be delivered. Shared by the core
+* thread, which adds to it, and the InvokeCallback event that delivers it.
+*/
+class PendingCallback : public base::RefCountedThreadSafe<PendingCallback>
+{
+	Lock lock;
+	Awesomium::JSArguments args;
+	bool isQueued;
+public:
+	PendingCallback() : isQueued(false) {}
+
+	/**
+	* Adds the arguments of an invocation (taking them over), returns true if the caller must queue
+	* an event to deliver them.
+	*/
+	bool add(Awesomium::JSArguments& invocationArgs, bool shouldAccumulate);
+
+	/**
+	* Takes the arguments to deliver, after which the next invocation queues a new event.
+	*/
+	void take(Awesomium::JSArguments& result);
 };
 
 class InvokeCallback : public WebViewEvent
 {
 	std::string name;
 	Awesomium::JSArguments args;
+	Awesomium::CallbackHandler* handler;
+	scoped_refptr<PendingCallback> pending;
 public:
-	InvokeCallback(Awesomium::WebView* view, const std::string& name, const Awesomium::JSArguments& args);
+	// Takes over 'args', leaving it empty
+	InvokeCallback(Awesomium::WebView* view, const std::string& name, Awesomium::JSArguments& args, Awesomium::CallbackHandler* handler);
+	InvokeCallback(Awesomium::WebView* view, const std::string& name, PendingCallback* pending, Awesomium::CallbackHandler* handler);
+	void run();
+	Priority getPriority() const { return PRIORITY_CALLBACK; }
+};
+
+/**
+* The console messages that have yet to be delivered. Shared by the core thread, which adds to it,
+* and the ReceiveConsoleMessages event that delivers it.
+*/
+class PendingConsoleMessages : public base::RefCountedThreadSafe<PendingConsoleMessages>
+{
+	Lock lock;
+	std::vector<Awesomium::ConsoleMessage> messages;
+	bool isQueued;
+public:
+	PendingConsoleMessages() : isQueued(false) {}
+
+	/**
+	* Adds a message, returns true if the caller must queue an event to deliver it.
+	*/
+	bool add(const Awesomium::ConsoleMessage& message);
+
+	/**
+	* Takes the messages to deliver, after which the next message queues a new event.
+	*/
+	void take(std::vector<Awesomium::ConsoleMessage>& result);
+};
+
+class ReceiveConsoleMessages : public WebViewEvent
+{
+	scoped_refptr<PendingConsoleMessages> pending;
+public:
+	ReceiveConsoleMessages(Awesomium::WebView* view, PendingConsoleMessages* pending);
 	void run();
 };
 
@@ -114,6 +194,7 @@ class ChangeKeyboardFocus : public WebViewEvent
 public:
 	ChangeKeyboardFocus(Awesomium::WebView* view, bool isFocused);
 	void run();
+	Priority getPriority() const { return PRIORITY_CALLBACK; }
 };
 
 class ChangeTargetURL : public WebViewEvent
@@ -123,6 +204,32 @@ public:
 	ChangeTargetURL(Awesomium::WebView* view, const std::string& url);
 	void run();
 };
+
+class ResolveFuture : public WebViewEvent
+{
+	Awesomium::FutureJSValueHandler* handler;
+	Awesomium::JSValue value;
+	Awesomium::JSError error;
+public:
+	ResolveFuture(Awesomium::WebView* view, Awesomium::FutureJSValueHandler* handler, const Awesomium::JSValue& value, const Awesomium::JSError& error);
+	void run();
+	Priority getPriority() const { return PRIORITY_CALLBACK; }
+};
+
+class ReceiveContentText : public WebViewEvent
+{
+	Awesomium::ContentTextHandler* handler;
+	Awesomium::TextEncoding encoding;
+	std::wstring wideText;
+	std::string utf8Text;
+	string16 utf16Text;
+	int totalLength; // -1 if more chunks will follow
+public:
+	ReceiveContentText(Awesomium::WebView* view, Awesomium::ContentTextHandler* handler, Awesomium::TextEncoding encoding, 
+		const string16& text, int totalLength);
+	void run();
+	Priority getPriority() const { return PRIORITY_CALLBACK; }
+};
 }
 
 
@@ -109,7 +109,8 @@ public:
 	/**
 	* This event is fired when keyboard focus has changed.
 	*
-	* @param	isFocused	Whether or not the keyboard is currently focused.
+	* @param	isFocused	Whether or not the keyboard is currently focused, that is, whether the focused
+	*						element accepts text (a text field, a text area or editable content).
 	*/
 	virtual void onChangeKeyboardFocus(bool isFocused) = 0;
 
@@ -122,6 +123,97 @@ public:
 	virtual void onChangeTargetURL(const std::string& url) = 0;
 };
 
+/**
+* CallbackHandler is a virtual interface that receives the invocations of a single 'Client'
+* callback; register it for a certain callback name via WebView::setCallback. This is dispatched
+* directly, as opposed to WebViewListener::onCallback which receives every callback by name.
+*/
+class _OSMExport CallbackHandler
+{
+public:
+	virtual ~CallbackHandler() {}
+
+	/**
+	* Called from within WebCore::update when the page invokes the callback.
+	*
+	* @param	caller	The WebView that the callback was invoked in.
+	*
+	* @param	name	The name of the callback that was invoked.
+	*
+	* @param	args	The arguments passed to the callback.
+	*/
+	virtual void handleCallback(WebView* caller, const std::string& name, const JSArguments& args) = 0;
+};
+
+/**
+* CoreThreadCallback is a virtual interface for 'Client' callbacks that must answer the page right
+* away: it is called from within the Javascript call itself and its result is returned to the page.
+* Register it for a certain callback name via WebView::setCallback.
+*
+* Unlike WebViewListener, it is called on the WebCore's core thread (or from within WebCore::update,
+* in single-threaded mode), while the page is blocked waiting on it. Implementations must therefore:
+*	- Guard any state shared with your own threads with your own locks.
+*	- Not call any WebView or WebCore methods, they are serviced by the very thread that is blocked.
+*	- Return quickly, nothing else is processed by the core thread in the meantime.
+*	- Stay alive for as long as the WebView does, or until another handler is set for the same name.
+*/
+class _OSMExport CoreThreadCallback
+{
+public:
+	virtual ~CoreThreadCallback() {}
+
+	/**
+	* Called when the page invokes the callback.
+	*
+	* @param	caller	The WebView that the callback was invoked in.
+	*
+	* @param	name	The name of the callback that was invoked.
+	*
+	* @param	args	The arguments passed to the callback.
+	*
+	* @return	The value to return to the page.
+	*/
+	virtual JSValue handleCallback(WebView* caller, const std::string& name, const JSArguments& args) = 0;
+};
+
+/**
+* A message that the page wrote to the console, such as an uncaught Javascript error.
+*/
+struct _OSMExport ConsoleMessage
+{
+	/// The text of the message.
+	std::wstring message;
+
+	/// The line that the message originated from, or 0 if it is unknown.
+	int line;
+
+	/// The URL of the script that the message originated from, if it is known.
+	std::wstring source;
+
+	ConsoleMessage() : line(0) {}
+	ConsoleMessage(const std::wstring& message, int line, const std::wstring& source) : message(message), line(line), source(source) {}
+};
+
+/**
+* ConsoleMessageHandler is a virtual interface that receives the console messages of a WebView;
+* register it via WebView::setConsoleMessageHandler. Messages are delivered in batches, a page that
+* writes to the console many times between two calls to WebCore::update only results in one call.
+*/
+class _OSMExport ConsoleMessageHandler
+{
+public:
+	virtual ~ConsoleMessageHandler() {}
+
+	/**
+	* Called from within WebCore::update with the messages written since the previous call, in order.
+	*
+	* @param	caller	The WebView that the messages were written in.
+	*
+	* @param	messages	The messages that were written.
+	*/
+	virtual void onConsoleMessages(WebView* caller, const std::vector<ConsoleMessage>& messages) = 0;
+};
+
 }
 
 #endif
@@ -30,7 +30,11 @@
 #include "PopupWidget.h"
 #include "WebView.h"
 #include "ClientObject.h"
+#include "WebViewCommand.h"
+#include "WebViewEvent.h"
 #include <vector>
+#include <map>
+#include <deque>
 #include "base/basictypes.h"
 #include "webkit/glue/webview.h"
 #include "WebCursorInfo.h"
@@ -54,13 +58,81 @@ using WebKit::WebFrame;
 class NavigationEntry;
 class NavigationController;
 
+/**
+* An input event that has been injected by the host but not yet dispatched
+* to WebKit, see WebViewProxy::queueInput.
+*/
+struct QueuedInputEvent
+{
+	enum Type
+	{
+		MOUSE_MOVE,
+		MOUSE_DOWN,
+		MOUSE_UP,
+		MOUSE_WHEEL,
+		KEY,
+		TEXT,
+		KEYBOARD
+	};
+
+	Type type;
+	int x, y; // The mouse position for MOUSE_MOVE, the scroll amounts for MOUSE_WHEEL
+	short button;
+	bool press;
+	int modifiers, windowsCode, nativeCode;
+	string16 text;
+#if defined(_WIN32)
+	HWND hwnd;
+	UINT message;
+	WPARAM wparam;
+	LPARAM lparam;
+#elif defined(__APPLE__)
+	NSEvent* keyboardEvent;
+#endif
+
+	QueuedInputEvent(Type type) : type(type), x(0), y(0), button(0), press(false), modifiers(0), windowsCode(0), nativeCode(0)
+	{
+	}
+};
+
+/**
+* An in-progress WebView::requestContentAsText, see WebViewProxy::deliverContentText.
+*/
+struct ContentTextRequest
+{
+	Awesomium::ContentTextHandler* handler;
+	Awesomium::TextEncoding encoding;
+	string16 text;
+	size_t offset, chunkSize;
+
+	ContentTextRequest(Awesomium::ContentTextHandler* handler, Awesomium::TextEncoding encoding, size_t chunkSize)
+		: handler(handler), encoding(encoding), offset(0), chunkSize(chunkSize)
+	{
+	}
+};
+
+/**
+* A function that was compiled for a JSFunction handle, along with the frame whose context it lives in.
+*/
+struct CompiledFunction
+{
+	NPObject* function;
+	WebFrame* frame;
+	std::wstring frameName;
+};
+
 class WebViewProxy : public WebViewDelegate
 {
 	int refCount;
+	WebViewCommandQueue* commandQueue;
+	WebViewCommand currentCommand;
 	int width, height;
 	gfx::Rect dirtyArea;
 	Awesomium::RenderBuffer* renderBuffer;
 	Awesomium::RenderBuffer* backBuffer;
+	Awesomium::RenderBuffer* frameBuffer;
+	gfx::Rect frameRect;
+	bool isFrameReady;
 	skia::PlatformCanvas* canvas;
 	int mouseX, mouseY;
 	int buttonState;
@@ -71,10 +143,18 @@ class WebViewProxy : public WebViewDelegate
 	bool isPopupsDirty;
 	bool needsPainting;
 	ClientObject* clientObject;
+	std::map<int, CompiledFunction> compiledFunctions; // Retained for JSFunction handles, by ID
+	std::deque<ContentTextRequest*> pendingContentText; // Streamed one chunk per slice, only touched on the core thread
+	Awesomium::JSError* capturedError; // Receives the last message reported while a request's script runs, if any
+	scoped_refptr<WebViewEvents::PendingConsoleMessages> pendingConsoleMessages;
 	WebKit::WebCursorInfo curCursor;
 	std::wstring curTooltip;
-	LockImpl *renderBufferLock, *refCountLock;
-	base::RepeatingTimer<WebViewProxy> renderTimer;
+	LockImpl *renderBufferLock, *refCountLock, *inputQueueLock;
+	std::vector<QueuedInputEvent> pendingInput, dispatchingInput;
+	bool isInputFlushPending;
+	int numInputInjected, numInputCoalesced;
+	base::OneShotTimer<WebViewProxy> renderTimer;
+	base::TimeTicks lastAsyncRenderTime;
 	const bool enableAsyncRendering;
 	bool isAsyncRenderDirty;
 	int maxAsyncRenderPerSec;
@@ -83,8 +163,20 @@ class WebViewProxy : public WebViewDelegate
 	NavigationController* navController;
 	int pageID, nextPageID;
 
+	// Scheduling state, guarded by the scheduler lock of the WebCoreProxy (see WebCoreProxy::scheduleView)
+	bool isScheduled;
+	int64 virtualTime;
+	base::TimeTicks readyTime;
+	int weight; // Only touched on the core thread
+	LockImpl* schedulingStatsLock;
+	int numSlices, maxQueueDelay;
+	int64 totalQueueDelay;
+
 	friend class NavigationController;
+	friend class Awesomium::WebView;
+	friend class WebCoreProxy;
 
+	void runCommand(WebViewCommand& command);
 	void closeAllPopups();
 	void handleMouseEvent(WebKit::WebInputEvent::Type type, short buttonID);
 	void overrideIFrameWindow(const std::wstring& frameName);
@@ -102,6 +194,14 @@ public:
 	void asyncStartup();
 	void asyncShutdown();
 
+	void drainCommands();
+	bool runSlice(int maxCommands, base::TimeDelta queueDelay);
+	bool hasPendingInput();
+	void setPriority(Awesomium::WebViewPriority priority);
+	void getSchedulingStats(int& numSlices, int& averageQueueDelay, int& maxQueueDelay);
+
+	static const int kMaxWeight = 8;
+
 	void loadURL(const std::string& url, const std::wstring& frameName, const std::string& username, const std::string& password);
 	void loadHTML(const std::string& html, const std::wstring& frameName);
 	void loadFile(const std::string& file, const std::wstring& frameName);
@@ -110,8 +210,23 @@ public:
 	void refresh();
 
 	void executeJavascript(const std::string& javascript, const std::wstring& frameName = std::wstring());
+
+	void executeJavascriptWithResult(const std::string& javascript, const std::wstring& frameName, int requestID);
+
+	void evaluateBatch(const std::vector<std::string>& expressions, const std::wstring& frameName, int firstRequestID);
+
+	bool evaluate(WebFrame* frame, const std::string& javascript, Awesomium::JSValue& result, Awesomium::JSError* error = 0);
+
+	void compileFunction(const std::string& source, const std::wstring& frameName, int functionID);
+	void invokeFunction(int functionID, const Awesomium::JSValue::Array& args, int requestID);
+	void releaseFunction(int functionID);
+	void releaseCompiledFunctions(WebFrame* frame);
+	WebFrame* getFrame(const std::wstring& frameName);
+
 	void setProperty(const std::string& name, const Awesomium::JSValue& value);
-	void setCallback(const std::string& name);
+	void setCallback(const std::string& name, Awesomium::CoreThreadCallback* coreThreadHandler, Awesomium::CallbackHandler* handler);
+	void setCallbackPolicy(const std::string& name, Awesomium::CallbackPolicy policy, int maxPerSecond);
+	void setCallbackReceivesBuffers(const std::string& name, bool receivesBuffers);
 
 	void mayBeginRender();
 
@@ -119,12 +234,22 @@ public:
 
 	void copyRenderBuffer(unsigned char* destination, int destRowSpan, int destDepth);
 
+	void scheduleAsyncRender();
+
 	void renderAsync();
 
 	void renderSync(unsigned char* destination, int destRowSpan, int destDepth, Awesomium::Rect* renderedRect);
 
+	void renderRequested();
+
+	bool copyRenderedFrame(unsigned char* destination, int destRowSpan, int destDepth, Awesomium::Rect* renderedRect);
+
 	void paint();
 
+	bool queueInput(const QueuedInputEvent& event);
+	void flushInput();
+	void getInputStats(int& numInjected, int& numCoalesced);
+
 	void injectMouseMove(int x, int y);
 	void injectMouseDown(short mouseButtonID);
 	void injectMouseUp(short mouseButtonID);
@@ -146,6 +271,8 @@ public:
 	void deselectAll();
 
 	void getContentAsText(std::wstring* result, int maxChars);
+	void requestContentAsText(Awesomium::ContentTextHandler* handler, int maxChars, Awesomium::TextEncoding encoding, int chunkSize);
+	bool deliverContentText(ContentTextRequest* request);
 
 	void zoomIn();
 	void zoomOut();
@@ -155,6 +282,8 @@ public:
 
 	void setTransparent(bool isTransparent);
 
+	void setFocus(bool isFocused);
+
 	void invalidatePopups();
 
 	void closePopup(PopupWidget* popup);
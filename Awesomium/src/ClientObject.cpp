@@ -26,73 +26,70 @@
 #include "ClientObject.h"
 #include "WebCore.h"
 #include "WebViewEvent.h"
+#include "WebBindings.h"
+#include "WebFrame.h"
+#include "base/string_util.h"
+#include "base/time.h"
+#include "v8.h"
+#include "NPV8Object.h"
+#include <set>
 
-void initFromCppArgumentList(const CppArgumentList& args, Awesomium::JSArguments& result);
+using WebKit::WebBindings;
+
+void initFromCppArgumentList(const CppArgumentList& args, Awesomium::JSArguments& result, bool receivesBuffers = false);
 
 class NamedCallback
 {
 	std::string name;
 	Awesomium::WebView* view;
+	ClientObject* owner;
+	Awesomium::CoreThreadCallback* coreThreadHandler;
+	Awesomium::CallbackHandler* handler;
+	Awesomium::CallbackPolicy policy;
+	int maxPerSecond, numInWindow;
+	base::TimeTicks windowStart;
+	scoped_refptr<WebViewEvents::PendingCallback> pending;
+	bool receivesBuffers;
 public:
-	NamedCallback(const std::string& name, Awesomium::WebView* view);
-
-	void handleCallback(const CppArgumentList& args, CppVariant* result);
-};
+	NamedCallback(const std::string& name, Awesomium::WebView* view, ClientObject* owner);
 
-class FutureValueCallback
-{
-	Awesomium::WebView* view;
-public:
-	FutureValueCallback(Awesomium::WebView* view) : view(view) {}
+	void setPolicy(Awesomium::CallbackPolicy policy, int maxPerSecond)
+	{
+		this->policy = policy;
+		this->maxPerSecond = maxPerSecond;
+	}
 
-	void handleCallback(const CppArgumentList& args, CppVariant* result);
-};
+	void setReceivesBuffers(bool receivesBuffers) { this->receivesBuffers = receivesBuffers; }
 
-class CheckKeyboardFocusCallback
-{
-	Awesomium::WebView* view;
-public:
-	CheckKeyboardFocusCallback(Awesomium::WebView* view) : view(view) {}
+	void setHandlers(Awesomium::CoreThreadCallback* coreThreadHandler, Awesomium::CallbackHandler* handler)
+	{
+		this->coreThreadHandler = coreThreadHandler;
+		this->handler = handler;
+	}
 
 	void handleCallback(const CppArgumentList& args, CppVariant* result);
 };
 
-ClientObject::ClientObject(Awesomium::WebView* view) : futureValueCallback(0), checkKeyboardFocusCallback(0), view(view)
+ClientObject::ClientObject(Awesomium::WebView* view) : windowObject(0), view(view)
 {
 }
 
 ClientObject::~ClientObject()
 {
-	if(futureValueCallback)
-		delete futureValueCallback;
-
-	if(checkKeyboardFocusCallback)
-		delete checkKeyboardFocusCallback;
-
 	for(std::map<std::string, CppVariant*>::iterator i = clientProperties.begin(); i != clientProperties.end(); i++)
 		delete i->second;
 
-	for(std::map<std::string, NamedCallback*>::iterator i = clientCallbacks.begin(); i != clientCallbacks.end(); i++)
+	for(base::hash_map<std::string, NamedCallback*>::iterator i = clientCallbacks.begin(); i != clientCallbacks.end(); i++)
 		delete i->second;
 }
 
-void ClientObject::initInternalCallbacks()
+void ClientObject::setWindowFrame(WebKit::WebFrame* frame)
 {
-	if(!futureValueCallback)
-	{
-		futureValueCallback = new FutureValueCallback(view);
-		CppBoundClass::Callback* callback = NewCallback<FutureValueCallback, const CppArgumentList&, 
-			CppVariant*>(futureValueCallback, &FutureValueCallback::handleCallback);
-		BindCallback("____futureValue", callback);
-	}
+	windowObject = frame->windowObject();
 
-	if(!checkKeyboardFocusCallback)
-	{
-		checkKeyboardFocusCallback = new CheckKeyboardFocusCallback(view);
-		CppBoundClass::Callback* callback = NewCallback<CheckKeyboardFocusCallback, const CppArgumentList&, 
-			CppVariant*>(checkKeyboardFocusCallback, &CheckKeyboardFocusCallback::handleCallback);
-		BindCallback("____checkKeyboardFocus", callback);
-	}
+	// The arrays and objects that we made in the previous context died with it
+	for(std::map<std::string, Awesomium::JSValue>::iterator i = containerProperties.begin(); i != containerProperties.end(); i++)
+		initCppVariant(i->second, *clientProperties[i->first], windowObject);
 }
 
 void ClientObject::setProperty(const std::string& name, const Awesomium::JSValue& value)
@@ -103,16 +100,7 @@ void ClientObject::setProperty(const std::string& name, const Awesomium::JSValue
 	{
 		CppVariant* newValue = new CppVariant();
 
-		if(value.isString())
-			newValue->Set(value.toString());
-		else if(value.isInteger())
-			newValue->Set(value.toInteger());
-		else if(value.isDouble())
-			newValue->Set(value.toDouble());
-		else if(value.isBoolean())
-			newValue->Set(value.toBoolean());
-		else
-			newValue->SetNull();
+		initCppVariant(value, *newValue, windowObject);
 		
 		clientProperties[name] = newValue;
 
@@ -120,79 +108,421 @@ void ClientObject::setProperty(const std::string& name, const Awesomium::JSValue
 	}
 	else
 	{
-		if(value.isString())
-			i->second->Set(value.toString());
-		else if(value.isInteger())
-			i->second->Set(value.toInteger());
-		else if(value.isDouble())
-			i->second->Set(value.toDouble());
-		else if(value.isBoolean())
-			i->second->Set(value.toBoolean());
-		else
-			i->second->SetNull();
+		initCppVariant(value, *i->second, windowObject);
 	}
+
+	if(value.isArray() || value.isObject())
+		containerProperties[name] = value;
+	else
+		containerProperties.erase(name);
 }
 
-void ClientObject::setCallback(const std::string& name)
+void ClientObject::setCallback(const std::string& name, Awesomium::CoreThreadCallback* coreThreadHandler, Awesomium::CallbackHandler* handler)
 {
-	if(clientCallbacks.find(name) == clientCallbacks.end())
-	{
-		NamedCallback* namedCallback = new NamedCallback(name, view);
-		
-		clientCallbacks[name] = namedCallback;
+	getNamedCallback(name)->setHandlers(coreThreadHandler, handler);
+}
 
-		CppBoundClass::Callback* callback = NewCallback<NamedCallback, const CppArgumentList&, 
-			CppVariant*>(namedCallback, &NamedCallback::handleCallback);
-		BindCallback(name, callback);
-	}
+void ClientObject::setCallbackPolicy(const std::string& name, Awesomium::CallbackPolicy policy, int maxPerSecond)
+{
+	getNamedCallback(name)->setPolicy(policy, maxPerSecond);
 }
 
-NamedCallback::NamedCallback(const std::string& name, Awesomium::WebView* view) : name(name), view(view)
+void ClientObject::setCallbackReceivesBuffers(const std::string& name, bool receivesBuffers)
+{
+	getNamedCallback(name)->setReceivesBuffers(receivesBuffers);
+}
+
+/**
+* Returns the callback with the given name, binding a new one if there is none yet.
+*/
+NamedCallback* ClientObject::getNamedCallback(const std::string& name)
+{
+	base::hash_map<std::string, NamedCallback*>::iterator i = clientCallbacks.find(name);
+
+	if(i != clientCallbacks.end())
+		return i->second;
+
+	NamedCallback* namedCallback = new NamedCallback(name, view, this);
+	
+	clientCallbacks[name] = namedCallback;
+
+	CppBoundClass::Callback* callback = NewCallback<NamedCallback, const CppArgumentList&, 
+		CppVariant*>(namedCallback, &NamedCallback::handleCallback);
+	BindCallback(name, callback);
+
+	return namedCallback;
+}
+
+NamedCallback::NamedCallback(const std::string& name, Awesomium::WebView* view, ClientObject* owner) 
+	: name(name), view(view), owner(owner), coreThreadHandler(0), handler(0), policy(Awesomium::CALLBACK_POLICY_DELIVER_ALL),
+	maxPerSecond(0), numInWindow(0), pending(new WebViewEvents::PendingCallback()), receivesBuffers(false)
 {
 }
 
 void NamedCallback::handleCallback(const CppArgumentList& args, CppVariant* result)
 {
 	Awesomium::JSArguments jsArgs;
-	initFromCppArgumentList(args, jsArgs);
+	initFromCppArgumentList(args, jsArgs, receivesBuffers);
+
+	if(coreThreadHandler)
+	{
+		// Answer the page right away, we're on the core thread within the call
+		initCppVariant(coreThreadHandler->handleCallback(view, name, jsArgs), *result, owner->windowObject);
+		return;
+	}
 
-	Awesomium::WebCore::Get().queueEvent(new WebViewEvents::InvokeCallback(view, name, jsArgs));
 	result->SetNull();
+
+	switch(policy)
+	{
+	case Awesomium::CALLBACK_POLICY_COALESCE_LATEST:
+	case Awesomium::CALLBACK_POLICY_ACCUMULATE:
+		// Only one event is queued at a time, further invocations are folded into it until it runs
+		if(pending->add(jsArgs, policy == Awesomium::CALLBACK_POLICY_ACCUMULATE))
+			Awesomium::WebCore::Get().queueEvent(new WebViewEvents::InvokeCallback(view, name, pending.get(), handler));
+		return;
+	case Awesomium::CALLBACK_POLICY_RATE_LIMIT:
+	{
+		// Without a positive limit there is nothing to limit
+		if(maxPerSecond <= 0)
+			break;
+
+		base::TimeTicks now = base::TimeTicks::Now();
+
+		if(now - windowStart >= base::TimeDelta::FromSeconds(1))
+		{
+			windowStart = now;
+			numInWindow = 0;
+		}
+
+		if(numInWindow >= maxPerSecond)
+			return;
+
+		numInWindow++;
+		break;
+	}
+	default:
+		break;
+	}
+
+	Awesomium::WebCore::Get().queueEvent(new WebViewEvents::InvokeCallback(view, name, jsArgs, handler));
 }
 
-void FutureValueCallback::handleCallback(const CppArgumentList& args, CppVariant* result)
+/**
+* Decodes a binary string (each character is one byte) straight from the bindings into a buffer,
+* this is the only copy that the bytes go through on their way to the host.
+*/
+static void initBufferFromNPString(const NPString& string, Awesomium::JSValue& result)
 {
-	Awesomium::JSArguments jsArgs;
-	initFromCppArgumentList(args, jsArgs);
+	const unsigned char* utf8 = (const unsigned char*)string.UTF8Characters;
+	const unsigned char* end = utf8 + string.UTF8Length;
 
-	view->handleFutureJSValueCallback(jsArgs);
-	result->SetNull();
+	// Characters 128 to 255 take two bytes in UTF-8, so the buffer is at most this big
+	Awesomium::JSBuffer buffer(string.UTF8Length);
+	unsigned char* output = buffer.getData();
+
+	while(utf8 < end)
+	{
+		if(*utf8 < 0x80)
+		{
+			*output++ = *utf8++;
+		}
+		else if((*utf8 & 0xFE) == 0xC2 && utf8 + 1 < end)
+		{
+			*output++ = ((utf8[0] & 0x1F) << 6) | (utf8[1] & 0x3F);
+			utf8 += 2;
+		}
+		else
+		{
+			// Not a binary string, skip the rest of this character
+			*output++ = '?';
+			for(utf8++; utf8 < end && (*utf8 & 0xC0) == 0x80; utf8++);
+		}
+	}
+
+	buffer.truncate(output - buffer.getData());
+	result = Awesomium::JSValue(buffer);
 }
 
-void CheckKeyboardFocusCallback::handleCallback(const CppArgumentList& args, CppVariant* result)
+void initFromCppArgumentList(const CppArgumentList& args, Awesomium::JSArguments& result, bool receivesBuffers)
 {
-	Awesomium::JSArguments jsArgs;
-	initFromCppArgumentList(args, jsArgs);
+	result.resize(args.size());
 
-	if(jsArgs.size())
-		view->handleCheckKeyboardFocus(jsArgs[0].toBoolean());
+	for(size_t i = 0; i < args.size(); i++)
+	{
+		if(receivesBuffers && NPVARIANT_IS_STRING(args[i]))
+			initBufferFromNPString(NPVARIANT_TO_STRING(args[i]), result[i]);
+		else
+			initFromNPVariant(args[i], result[i]);
+	}
+}
 
-	result->SetNull();
+// Guards against absurdly deep or large structures
+static const int kMaxConversionDepth = 32;
+static const int kMaxArrayLength = 1 << 20;
+static const int kMaxConversionNodes = 1 << 20;
+
+/**
+* The state of one conversion from the bindings. An object that refers back to one of its ancestors
+* is converted to null, other shared references are converted again wherever they appear. The total
+* number of values converted is bounded, so that a structure with a lot of sharing can't blow up.
+*/
+struct NPConversionState
+{
+	std::set<NPObject*> ancestors;
+	int numNodes;
+
+	NPConversionState() : numNodes(0) {}
+};
+
+static void convertNPVariant(const NPVariant& variant, Awesomium::JSValue& result, NPConversionState& state);
+
+enum NPObjectKind { NPOBJECT_OTHER, NPOBJECT_ARRAY, NPOBJECT_PLAIN };
+
+/**
+* Classifies an object by asking V8 directly, nothing that the page can redefine (such as 'constructor')
+* is read. Only the page's own arrays and plain objects are worth converting: a plain object is one whose
+* prototype is Object.prototype (or null), which has no prototype of its own. Host objects (DOM nodes,
+* events, windows) carry internal fields, and are never walked, nor are functions.
+*/
+static NPObjectKind getNPObjectKind(NPObject* object)
+{
+	// Objects that don't wrap a V8 object belong to plugins or to us
+	if(object->_class != npScriptObjectClass)
+		return NPOBJECT_OTHER;
+
+	v8::HandleScope handleScope;
+	v8::Handle<v8::Object> v8Object = reinterpret_cast<V8NPObject*>(object)->v8Object;
+
+	if(v8Object.IsEmpty() || v8Object->IsFunction() || v8Object->InternalFieldCount())
+		return NPOBJECT_OTHER;
+
+	if(v8Object->IsArray())
+		return NPOBJECT_ARRAY;
+
+	v8::Handle<v8::Value> prototype = v8Object->GetPrototype();
+
+	if(prototype->IsNull())
+		return NPOBJECT_PLAIN;
+
+	if(!prototype->IsObject() || prototype->IsFunction() || v8::Handle<v8::Object>::Cast(prototype)->InternalFieldCount())
+		return NPOBJECT_OTHER;
+
+	return v8::Handle<v8::Object>::Cast(prototype)->GetPrototype()->IsNull() ? NPOBJECT_PLAIN : NPOBJECT_OTHER;
+}
+
+/**
+* Converts an array or a plain object, walking it directly via the bindings so that the page doesn't
+* have to stringify it for us. Anything else, and any object that contains itself, is converted to null.
+*/
+static void initFromNPObject(NPObject* object, Awesomium::JSValue& result, NPConversionState& state)
+{
+	result = Awesomium::JSValue();
+
+	if((int)state.ancestors.size() >= kMaxConversionDepth || state.ancestors.count(object))
+		return;
+
+	NPObjectKind kind = getNPObjectKind(object);
+
+	if(kind == NPOBJECT_OTHER)
+		return;
+
+	state.ancestors.insert(object);
+
+	if(kind == NPOBJECT_ARRAY)
+	{
+		NPVariant length;
+		int count = 0;
+
+		if(WebBindings::getProperty(0, object, WebBindings::getStringIdentifier("length"), &length))
+		{
+			if(NPVARIANT_IS_INT32(length))
+				count = NPVARIANT_TO_INT32(length);
+			else if(NPVARIANT_IS_DOUBLE(length))
+				count = (int)NPVARIANT_TO_DOUBLE(length);
+
+			WebBindings::releaseVariantValue(&length);
+		}
+
+		count = count < 0 ? 0 : (count > kMaxArrayLength ? kMaxArrayLength : count);
+
+		Awesomium::JSValue::Array& elements = result.getArray();
+		elements.resize(count);
+
+		// Stop reading once the budget has run out, the remaining elements stay null
+		for(int i = 0; i < count && state.numNodes < kMaxConversionNodes; i++)
+		{
+			NPVariant element;
+
+			if(WebBindings::getProperty(0, object, WebBindings::getIntIdentifier(i), &element))
+			{
+				convertNPVariant(element, elements[i], state);
+				WebBindings::releaseVariantValue(&element);
+			}
+		}
+	}
+	else
+	{
+		Awesomium::JSValue::Object& properties = result.getObject();
+		NPIdentifier* identifiers = 0;
+		uint32_t count = 0;
+
+		if(WebBindings::enumerate(0, object, &identifiers, &count))
+		{
+			for(uint32_t i = 0; i < count && state.numNodes < kMaxConversionNodes; i++)
+			{
+				NPVariant property;
+
+				if(!WebBindings::getProperty(0, object, identifiers[i], &property))
+					continue;
+
+				std::string name;
+
+				if(WebBindings::identifierIsString(identifiers[i]))
+				{
+					NPUTF8* utf8Name = WebBindings::utf8FromIdentifier(identifiers[i]);
+					name = utf8Name;
+					free(utf8Name);
+				}
+				else
+				{
+					name = IntToString(WebBindings::intFromIdentifier(identifiers[i]));
+				}
+
+				convertNPVariant(property, properties[name], state);
+				WebBindings::releaseVariantValue(&property);
+			}
+
+			free(identifiers);
+		}
+	}
+
+	state.ancestors.erase(object);
+}
+
+static void convertNPVariant(const NPVariant& variant, Awesomium::JSValue& result, NPConversionState& state)
+{
+	// Past the budget, whatever is left is converted to null
+	if(++state.numNodes > kMaxConversionNodes)
+		result = Awesomium::JSValue();
+	else if(NPVARIANT_IS_INT32(variant))
+		result = Awesomium::JSValue((int)NPVARIANT_TO_INT32(variant));
+	else if(NPVARIANT_IS_DOUBLE(variant))
+		result = Awesomium::JSValue(NPVARIANT_TO_DOUBLE(variant));
+	else if(NPVARIANT_IS_BOOLEAN(variant))
+		result = Awesomium::JSValue(NPVARIANT_TO_BOOLEAN(variant));
+	else if(NPVARIANT_IS_STRING(variant))
+		result = Awesomium::JSValue(std::string(NPVARIANT_TO_STRING(variant).UTF8Characters, NPVARIANT_TO_STRING(variant).UTF8Length));
+	else if(NPVARIANT_IS_OBJECT(variant))
+		initFromNPObject(NPVARIANT_TO_OBJECT(variant), result, state);
+	else
+		result = Awesomium::JSValue();
 }
 
-void initFromCppArgumentList(const CppArgumentList& args, Awesomium::JSArguments& result)
+void initFromNPVariant(const NPVariant& variant, Awesomium::JSValue& result)
 {
-	for(CppArgumentList::const_iterator i = args.begin(); i != args.end(); i++)
+	NPConversionState state;
+	convertNPVariant(variant, result, state);
+}
+
+/**
+* Creates an empty Javascript array or object in the context of a window.
+*/
+static NPObject* createContainer(NPObject* windowObject, bool isArray)
+{
+	const char* source = isArray ? "[]" : "({})";
+	NPString script = { source, (uint32_t)strlen(source) };
+	NPVariant container;
+
+	if(!WebBindings::evaluate(0, windowObject, &script, &container))
+		return 0;
+
+	if(!NPVARIANT_IS_OBJECT(container))
 	{
-		if(i->isInt32())
-			result.push_back(i->ToInt32());
-		else if(i->isDouble())
-			result.push_back(i->ToDouble());
-		else if(i->isBool())
-			result.push_back(i->ToBoolean());
-		else if(i->isString())
-			result.push_back(i->ToString());
+		WebBindings::releaseVariantValue(&container);
+		return 0;
+	}
+
+	// The reference that the result held is now ours
+	return NPVARIANT_TO_OBJECT(container);
+}
+
+void initCppVariant(const Awesomium::JSValue& value, CppVariant& result, NPObject* windowObject, int depth)
+{
+	if(value.isString())
+		result.Set(value.toString());
+	else if(value.isInteger())
+		result.Set(value.toInteger());
+	else if(value.isDouble())
+		result.Set(value.toDouble());
+	else if(value.isBoolean())
+		result.Set(value.toBoolean());
+	else if(value.isBuffer())
+	{
+		// Encode the bytes straight into the string that the bindings take over, as a binary string
+		Awesomium::JSBuffer buffer = value.getBuffer();
+		const unsigned char* data = buffer.getData();
+		size_t length = 0;
+
+		for(size_t i = 0; i < buffer.getSize(); i++)
+			length += data[i] < 0x80 ? 1 : 2;
+
+		char* utf8 = (char*)malloc(length ? length : 1);
+		char* output = utf8;
+
+		for(size_t i = 0; i < buffer.getSize(); i++)
+		{
+			if(data[i] < 0x80)
+			{
+				*output++ = data[i];
+			}
+			else
+			{
+				*output++ = (char)(0xC0 | (data[i] >> 6));
+				*output++ = (char)(0x80 | (data[i] & 0x3F));
+			}
+		}
+
+		result.FreeData();
+		STRINGN_TO_NPVARIANT(utf8, (uint32_t)length, result);
+	}
+	else if((value.isArray() || value.isObject()) && windowObject && depth < kMaxConversionDepth)
+	{
+		NPObject* container = createContainer(windowObject, value.isArray());
+
+		if(!container)
+		{
+			result.SetNull();
+			return;
+		}
+
+		if(value.isArray())
+		{
+			const Awesomium::JSValue::Array& elements = value.getArray();
+
+			for(size_t i = 0; i < elements.size(); i++)
+			{
+				CppVariant element;
+				initCppVariant(elements[i], element, windowObject, depth + 1);
+				WebBindings::setProperty(0, container, WebBindings::getIntIdentifier((int32_t)i), &element);
+			}
+		}
 		else
-			result.push_back(Awesomium::JSValue());
+		{
+			const Awesomium::JSValue::Object& properties = value.getObject();
+
+			for(Awesomium::JSValue::Object::const_iterator i = properties.begin(); i != properties.end(); i++)
+			{
+				CppVariant property;
+				initCppVariant(i->second, property, windowObject, depth + 1);
+				WebBindings::setProperty(0, container, WebBindings::getStringIdentifier(i->first.c_str()), &property);
+			}
+		}
+
+		// CppVariant::Set retains the object, give up our own reference
+		result.Set(container);
+		WebBindings::releaseObject(container);
 	}
+	else
+		result.SetNull();
 }
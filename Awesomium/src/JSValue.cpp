@@ -25,31 +25,328 @@
 
 #include "JSValue.h"
 #include "WebCore.h"
-#include <sstream>
+#include "WebViewEvent.h"
+#include "base/atomicops.h"
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
 
-template<class NumberType>
-inline NumberType stringToNumber(const std::string& numberString)
+// Number conversions, these are locale-independent and never allocate
+
+static const double powersOfTen[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+static bool hasPrefix(const char* string, const char* end, const char* prefix)
 {
-	if(numberString.substr(0, 4).compare("true") == 0) return 1;
-	else if(numberString.substr(0, 4).compare("false") == 0) return 0;
+	for(; *prefix; string++, prefix++)
+		if(string == end || *string != *prefix)
+			return false;
+
+	return true;
+}
 
-	std::istringstream converter(numberString);
+static const char* skipWhitespace(const char* string, const char* end)
+{
+	while(string < end && (*string == ' ' || (*string >= '\t' && *string <= '\r')))
+		string++;
 
-	NumberType result;
-	return (converter >> result).fail() ? 0 : result;
+	return string;
 }
 
-template<class NumberType>
-inline std::string numberToString(const NumberType &number)
+/**
+* Parses the leading integer of a string, like a stream would: returns 0 if there is none or if it overflows.
+*/
+static int parseInteger(const char* string, size_t length)
 {
-	std::ostringstream converter;
+	const char* end = string + length;
+
+	if(hasPrefix(string, end, "true")) return 1;
+	else if(hasPrefix(string, end, "false")) return 0;
+
+	string = skipWhitespace(string, end);
+
+	bool isNegative = string < end && *string == '-';
+	if(string < end && (*string == '-' || *string == '+'))
+		string++;
+
+	// Accumulate negatively so that INT_MIN fits
+	int result = 0;
+
+	for(; string < end && *string >= '0' && *string <= '9'; string++)
+	{
+		int digit = *string - '0';
+
+		if(result < (-2147483647 - 1 + digit) / 10)
+			return 0;
+
+		result = result * 10 - digit;
+	}
+
+	if(!isNegative)
+		return result == -2147483647 - 1 ? 0 : -result;
 
-	return (converter << number).fail() ? "" : converter.str();
+	return result;
 }
 
+/**
+* Parses the leading decimal number of a string (digits, a fraction and an exponent), returns 0 if there is none
+* or if it overflows. Numbers with up to 15 significant digits and an exponent within 22 are converted exactly.
+*/
+static double parseDouble(const char* string, size_t length)
+{
+	const char* end = string + length;
+
+	if(hasPrefix(string, end, "true")) return 1;
+	else if(hasPrefix(string, end, "false")) return 0;
+
+	string = skipWhitespace(string, end);
+
+	bool isNegative = string < end && *string == '-';
+	if(string < end && (*string == '-' || *string == '+'))
+		string++;
+
+	unsigned long long mantissa = 0;
+	int numDigits = 0, exponent = 0;
+	bool hasDigits = false;
+
+	for(; string < end && *string >= '0' && *string <= '9'; string++)
+	{
+		hasDigits = true;
+
+		if(numDigits < 19)
+		{
+			mantissa = mantissa * 10 + (*string - '0');
+			numDigits += mantissa != 0;
+		}
+		else
+			exponent++;
+	}
+
+	if(string < end && *string == '.')
+	{
+		for(string++; string < end && *string >= '0' && *string <= '9'; string++)
+		{
+			hasDigits = true;
+
+			if(numDigits < 19)
+			{
+				mantissa = mantissa * 10 + (*string - '0');
+				numDigits += mantissa != 0;
+				exponent--;
+			}
+		}
+	}
+
+	if(!hasDigits)
+		return 0;
+
+	if(string < end && (*string == 'e' || *string == 'E'))
+	{
+		const char* exponentString = string + 1;
+		bool isExponentNegative = exponentString < end && *exponentString == '-';
+		if(exponentString < end && (*exponentString == '-' || *exponentString == '+'))
+			exponentString++;
+
+		int explicitExponent = 0;
+
+		for(; exponentString < end && *exponentString >= '0' && *exponentString <= '9'; exponentString++)
+			if(explicitExponent < 10000)
+				explicitExponent = explicitExponent * 10 + (*exponentString - '0');
+
+		exponent += isExponentNegative ? -explicitExponent : explicitExponent;
+	}
+
+	double result = (double)mantissa;
+
+	// Both the mantissa and the power of ten are exact here, so the result is correctly rounded
+	if(mantissa < (1ULL << 53) && exponent >= -22 && exponent <= 22)
+		result = exponent < 0 ? result / powersOfTen[-exponent] : result * powersOfTen[exponent];
+	else if(mantissa)
+		result *= pow(10.0, exponent);
+
+	// A stream fails on overflow
+	if(result > 1.7976931348623157e308)
+		return 0;
+
+	return isNegative ? -result : result;
+}
+
+/**
+* Formats an integer into a buffer of at least 12 characters, returns the length (not null-terminated).
+*/
+static size_t formatInteger(int number, char* buffer)
+{
+	char digits[12];
+	size_t numDigits = 0;
+
+	// Work with the negative value so that INT_MIN doesn't overflow
+	int remainder = number < 0 ? number : -number;
+
+	do
+	{
+		digits[numDigits++] = (char)('0' - remainder % 10);
+		remainder /= 10;
+	}
+	while(remainder);
+
+	size_t length = 0;
+
+	if(number < 0)
+		buffer[length++] = '-';
+
+	while(numDigits)
+		buffer[length++] = digits[--numDigits];
+
+	return length;
+}
+
+/**
+* Formats a double like a stream would (6 significant digits) into a buffer of at least 32 characters,
+* returns the length (not null-terminated).
+*/
+static size_t formatDouble(double number, char* buffer)
+{
+	int length = sprintf(buffer, "%g", number);
+
+	// The decimal point comes from the current locale, we always want a period
+	for(int i = 0; i < length; i++)
+		if(buffer[i] != '-' && buffer[i] != '+' && (buffer[i] < '0' || buffer[i] > '9') && (buffer[i] < 'a' || buffer[i] > 'z')
+			&& (buffer[i] < 'A' || buffer[i] > 'Z') && buffer[i] != '#')
+			buffer[i] = '.';
+
+	return length < 0 ? 0 : (size_t)length;
+}
+
+/**
+* Writes to a buffer of a fixed size, measuring what doesn't fit.
+*/
+class StringWriter
+{
+	char* buffer;
+	size_t bufferSize, length;
+public:
+	StringWriter(char* buffer, size_t bufferSize) : buffer(buffer), bufferSize(bufferSize), length(0) {}
+
+	void append(const char* string, size_t stringLength)
+	{
+		if(length + 1 < bufferSize)
+		{
+			size_t numToCopy = bufferSize - 1 - length;
+			memcpy(buffer + length, string, stringLength < numToCopy ? stringLength : numToCopy);
+		}
+
+		length += stringLength;
+	}
+
+	// Where a nested value may write itself (with its null-terminator), see StringWriter::advance
+	char* getPosition() const { return length < bufferSize ? buffer + length : 0; }
+	size_t getRemaining() const { return length < bufferSize ? bufferSize - length : 0; }
+
+	void advance(size_t nestedLength) { length += nestedLength; }
+
+	size_t finish()
+	{
+		if(bufferSize)
+			buffer[length < bufferSize ? length : bufferSize - 1] = 0;
+
+		return length;
+	}
+};
+
 using namespace Awesomium;
 using namespace Impl;
 
+namespace Impl {
+
+struct BufferStorage
+{
+	base::subtle::Atomic32 refCount;
+	size_t size;
+	unsigned char* data;
+};
+
+}
+
+static BufferStorage* createBufferStorage(size_t size)
+{
+	BufferStorage* storage = new BufferStorage();
+	storage->refCount = 1;
+	storage->size = size;
+	storage->data = size ? new unsigned char[size] : 0;
+
+	return storage;
+}
+
+static BufferStorage* retainBufferStorage(BufferStorage* storage)
+{
+	base::subtle::Barrier_AtomicIncrement(&storage->refCount, 1);
+
+	return storage;
+}
+
+static void releaseBufferStorage(BufferStorage* storage)
+{
+	if(base::subtle::Barrier_AtomicIncrement(&storage->refCount, -1) == 0)
+	{
+		delete[] storage->data;
+		delete storage;
+	}
+}
+
+JSBuffer::JSBuffer() : storage(createBufferStorage(0))
+{
+}
+
+JSBuffer::JSBuffer(const void* data, size_t size) : storage(createBufferStorage(size))
+{
+	if(size)
+		memcpy(storage->data, data, size);
+}
+
+JSBuffer::JSBuffer(size_t size) : storage(createBufferStorage(size))
+{
+}
+
+JSBuffer::JSBuffer(const JSBuffer& other) : storage(retainBufferStorage(other.storage))
+{
+}
+
+JSBuffer::~JSBuffer()
+{
+	releaseBufferStorage(storage);
+}
+
+JSBuffer& JSBuffer::operator=(const JSBuffer& rhs)
+{
+	BufferStorage* previous = storage;
+	storage = retainBufferStorage(rhs.storage);
+	releaseBufferStorage(previous);
+
+	return *this;
+}
+
+const unsigned char* JSBuffer::getData() const
+{
+	return storage->data;
+}
+
+unsigned char* JSBuffer::getData()
+{
+	return storage->data;
+}
+
+size_t JSBuffer::getSize() const
+{
+	return storage->size;
+}
+
+void JSBuffer::truncate(size_t size)
+{
+	if(size < storage->size)
+		storage->size = size;
+}
+
 JSValue::JSValue()
 {
 	varValue.type = VariantType_NULL;
@@ -58,19 +355,19 @@ JSValue::JSValue()
 JSValue::JSValue(bool value)
 {
 	varValue.type = VariantType_BOOLEAN;
-	varValue.numericValue.booleanValue = value;
+	varValue.value.booleanValue = value;
 }
 
 JSValue::JSValue(int value)
 {
 	varValue.type = VariantType_INTEGER;
-	varValue.numericValue.integerValue = value;
+	varValue.value.integerValue = value;
 }
 
 JSValue::JSValue(double value)
 {
 	varValue.type = VariantType_DOUBLE;
-	varValue.numericValue.doubleValue = value;
+	varValue.value.doubleValue = value;
 }
 
 JSValue::JSValue(const char* value)
@@ -85,6 +382,74 @@ JSValue::JSValue(const std::string& value)
 	varValue.stringValue = value;
 }
 
+JSValue::JSValue(const Array& value)
+{
+	varValue.type = VariantType_ARRAY;
+	varValue.value.arrayValue = new Array(value);
+}
+
+JSValue::JSValue(const Object& value)
+{
+	varValue.type = VariantType_OBJECT;
+	varValue.value.objectValue = new Object(value);
+}
+
+JSValue::JSValue(const JSBuffer& value)
+{
+	varValue.type = VariantType_BUFFER;
+	varValue.value.bufferValue = retainBufferStorage(value.storage);
+}
+
+JSValue::JSValue(const JSValue& original)
+{
+	varValue.type = original.varValue.type;
+
+	if(varValue.type == VariantType_STRING)
+		varValue.stringValue = original.varValue.stringValue;
+	else if(varValue.type == VariantType_ARRAY)
+		varValue.value.arrayValue = new Array(*original.varValue.value.arrayValue);
+	else if(varValue.type == VariantType_OBJECT)
+		varValue.value.objectValue = new Object(*original.varValue.value.objectValue);
+	else if(varValue.type == VariantType_BUFFER)
+		varValue.value.bufferValue = retainBufferStorage(original.varValue.value.bufferValue);
+	else
+		varValue.value = original.varValue.value;
+}
+
+JSValue::~JSValue()
+{
+	release();
+}
+
+JSValue& JSValue::operator=(const JSValue& rhs)
+{
+	// Copy first, 'rhs' may live inside of one of our own containers
+	JSValue copy(rhs);
+	swap(copy);
+
+	return *this;
+}
+
+void JSValue::swap(JSValue& other)
+{
+	std::swap(varValue.type, other.varValue.type);
+	std::swap(varValue.value, other.varValue.value);
+	varValue.stringValue.swap(other.varValue.stringValue);
+}
+
+void JSValue::release()
+{
+	if(varValue.type == VariantType_ARRAY)
+		delete varValue.value.arrayValue;
+	else if(varValue.type == VariantType_OBJECT)
+		delete varValue.value.objectValue;
+	else if(varValue.type == VariantType_BUFFER)
+		releaseBufferStorage(varValue.value.bufferValue);
+
+	varValue.type = VariantType_NULL;
+	varValue.stringValue.clear();
+}
+
 bool JSValue::isBoolean() const
 {
 	return varValue.type == VariantType_BOOLEAN;
@@ -115,35 +480,97 @@ bool JSValue::isNull() const
 	return varValue.type == VariantType_NULL;
 }
 
+bool JSValue::isArray() const
+{
+	return varValue.type == VariantType_ARRAY;
+}
+
+bool JSValue::isObject() const
+{
+	return varValue.type == VariantType_OBJECT;
+}
+
+bool JSValue::isBuffer() const
+{
+	return varValue.type == VariantType_BUFFER;
+}
+
 const std::string& JSValue::toString() const
 {
 	if(isString())
 		return varValue.stringValue;
 
-	static std::string tempResult;
+	// The cache reuses its capacity, so converting the same JSValue again doesn't allocate
+	std::string& cache = varValue.stringValue;
+
+	if(isArray())
+	{
+		// Like Array.prototype.toString, each element caches its own conversion
+		cache.clear();
+
+		for(Array::const_iterator i = varValue.value.arrayValue->begin(); i != varValue.value.arrayValue->end(); i++)
+		{
+			if(i != varValue.value.arrayValue->begin())
+				cache += ',';
+
+			cache += i->toString();
+		}
+	}
+	else if(isBuffer())
+	{
+		cache.assign((const char*)varValue.value.bufferValue->data, varValue.value.bufferValue->size);
+	}
+	else
+	{
+		char buffer[32];
+		cache.assign(buffer, std::min(toString(buffer, sizeof(buffer)), sizeof(buffer) - 1));
+	}
+
+	return cache;
+}
 
-	if(isInteger())
-		tempResult = numberToString<int>(varValue.numericValue.integerValue);
+size_t JSValue::toString(char* buffer, size_t bufferSize) const
+{
+	StringWriter writer(buffer, bufferSize);
+	char number[32];
+
+	if(isString())
+		writer.append(varValue.stringValue.data(), varValue.stringValue.length());
+	else if(isInteger())
+		writer.append(number, formatInteger(varValue.value.integerValue, number));
 	else if(isDouble())
-		tempResult = numberToString<double>(varValue.numericValue.doubleValue);
+		writer.append(number, formatDouble(varValue.value.doubleValue, number));
 	else if(isBoolean())
-		tempResult = numberToString<bool>(varValue.numericValue.booleanValue);
-	else
-		tempResult = "";
+		writer.append(varValue.value.booleanValue ? "1" : "0", 1);
+	else if(isArray())
+	{
+		for(Array::const_iterator i = varValue.value.arrayValue->begin(); i != varValue.value.arrayValue->end(); i++)
+		{
+			if(i != varValue.value.arrayValue->begin())
+				writer.append(",", 1);
+
+			// Each element writes itself in place
+			writer.advance(i->toString(writer.getPosition(), writer.getRemaining()));
+		}
+	}
+	else if(isObject())
+		writer.append("[object Object]", 15);
+	else if(isBuffer())
+		writer.append((const char*)varValue.value.bufferValue->data, varValue.value.bufferValue->size);
 
-	return tempResult;
+	return writer.finish();
 }
 
 int JSValue::toInteger() const
 {
 	if(isString())
-		return stringToNumber<int>(varValue.stringValue);
+		return parseInteger(varValue.stringValue.data(), varValue.stringValue.length());
 	else if(isInteger())
-		return varValue.numericValue.integerValue;
+		return varValue.value.integerValue;
 	else if(isDouble())
-		return (int)varValue.numericValue.doubleValue;
+		return (int)varValue.value.doubleValue;
 	else if(isBoolean())
-		return (int)varValue.numericValue.booleanValue;
+		return (int)varValue.value.booleanValue;
 	else
 		return 0;
 }
@@ -151,31 +578,85 @@ int JSValue::toInteger() const
 double JSValue::toDouble() const
 {
 	if(isString())
-		return stringToNumber<double>(varValue.stringValue);
+		return parseDouble(varValue.stringValue.data(), varValue.stringValue.length());
 	else if(isInteger())
-		return (double)varValue.numericValue.integerValue;
+		return (double)varValue.value.integerValue;
 	else if(isDouble())
-		return varValue.numericValue.doubleValue;
+		return varValue.value.doubleValue;
 	else if(isBoolean())
-		return (double)varValue.numericValue.booleanValue;
+		return (double)varValue.value.booleanValue;
 	else
 		return 0;
 }
 
 bool JSValue::toBoolean() const
 {
+	// Like a stream would, only "true" and "1" (or a number that starts with 1) are true
 	if(isString())
-		return stringToNumber<bool>(varValue.stringValue);
+		return parseInteger(varValue.stringValue.data(), varValue.stringValue.length()) == 1;
 	else if(isInteger())
-		return !!varValue.numericValue.integerValue;
+		return !!varValue.value.integerValue;
 	else if(isDouble())
-		return !!static_cast<int>(varValue.numericValue.doubleValue);
+		return !!static_cast<int>(varValue.value.doubleValue);
 	else if(isBoolean())
-		return varValue.numericValue.booleanValue;
+		return varValue.value.booleanValue;
+	else if(isArray() || isObject() || isBuffer())
+		return true;
 	else
 		return false;
 }
 
+const JSValue::Array& JSValue::getArray() const
+{
+	static const Array emptyArray;
+
+	return isArray() ? *varValue.value.arrayValue : emptyArray;
+}
+
+JSValue::Array& JSValue::getArray()
+{
+	if(!isArray())
+	{
+		release();
+		varValue.type = VariantType_ARRAY;
+		varValue.value.arrayValue = new Array();
+	}
+
+	return *varValue.value.arrayValue;
+}
+
+const JSValue::Object& JSValue::getObject() const
+{
+	static const Object emptyObject;
+
+	return isObject() ? *varValue.value.objectValue : emptyObject;
+}
+
+JSValue::Object& JSValue::getObject()
+{
+	if(!isObject())
+	{
+		release();
+		varValue.type = VariantType_OBJECT;
+		varValue.value.objectValue = new Object();
+	}
+
+	return *varValue.value.objectValue;
+}
+
+JSBuffer JSValue::getBuffer() const
+{
+	JSBuffer result;
+
+	if(isBuffer())
+	{
+		releaseBufferStorage(result.storage);
+		result.storage = retainBufferStorage(varValue.value.bufferValue);
+	}
+
+	return result;
+}
+
 FutureJSValue::FutureJSValue() : source(0), requestID(0)
 {
 }
@@ -191,12 +672,83 @@ void FutureJSValue::init(WebView* source, int requestID)
 }
 
 const JSValue& FutureJSValue::get()
+{
+	return get(-1);
+}
+
+const JSValue& FutureJSValue::get(int timeoutMilliseconds)
 {
 	if(requestID)
 	{
-		Awesomium::WebCore::Get().resolveJSValueFuture(source, requestID, &value);
-		requestID = 0;
+		if(Awesomium::WebCore::Get().resolveJSValueFuture(source, requestID, &value, &error, timeoutMilliseconds))
+			requestID = 0;
 	}
 	
 	return value;
 }
+
+bool FutureJSValue::isReady() const
+{
+	return !requestID || Awesomium::WebCore::Get().isJSValueFutureResolved(source, requestID);
+}
+
+bool FutureJSValue::hasError() const
+{
+	return error.isError();
+}
+
+const JSError& FutureJSValue::getError() const
+{
+	return error;
+}
+
+void FutureJSValue::then(FutureJSValueHandler* handler)
+{
+	if(requestID)
+	{
+		Awesomium::WebCore::Get().setJSValueFutureHandler(source, requestID, handler);
+		requestID = 0;
+		value = JSValue();
+		error = JSError();
+	}
+	else
+	{
+		// Already resolved, deliver what we have
+		Awesomium::WebCore::Get().queueEvent(new WebViewEvents::ResolveFuture(0, handler, value, error));
+	}
+}
+
+JSFunction::JSFunction() : source(0), functionID(0)
+{
+}
+
+void JSFunction::init(WebView* source, int functionID)
+{
+	this->source = source;
+	this->functionID = functionID;
+}
+
+FutureJSValue JSFunction::invoke(const JSArguments& args)
+{
+	FutureJSValue futureValue;
+
+	// The handle may have outlived its WebView
+	if(functionID && Awesomium::WebCore::Get().pinWebView(source))
+	{
+		futureValue = source->invokeFunction(functionID, args);
+		Awesomium::WebCore::Get().unpinWebView(source);
+	}
+
+	return futureValue;
+}
+
+void JSFunction::release()
+{
+	if(functionID && Awesomium::WebCore::Get().pinWebView(source))
+	{
+		source->releaseFunction(functionID);
+		Awesomium::WebCore::Get().unpinWebView(source);
+	}
+
+	functionID = 0;
+}
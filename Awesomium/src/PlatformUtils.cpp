@@ -85,3 +85,79 @@ void Impl::initWebCorePlatform()
 	suppressLeakChecking();
 }
 #endif
+
+#include "WebCore.h"
+#include "base/logging.h"
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__APPLE__)
+#include <pthread.h>
+#include <sched.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+void Impl::applyThreadOptions(const Awesomium::ThreadOptions& options)
+{
+#if defined(_WIN32)
+	if(options.affinityMask)
+	{
+		if(!SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)options.affinityMask))
+			LOG(WARNING) << "Could not set the thread affinity mask.";
+	}
+
+	if(options.priority != Awesomium::TP_NORMAL)
+	{
+		static const int priorities[] = { THREAD_PRIORITY_LOWEST, THREAD_PRIORITY_BELOW_NORMAL, THREAD_PRIORITY_NORMAL,
+			THREAD_PRIORITY_ABOVE_NORMAL, THREAD_PRIORITY_HIGHEST };
+
+		if(!SetThreadPriority(GetCurrentThread(), priorities[options.priority]))
+			LOG(WARNING) << "Could not set the thread priority.";
+	}
+#elif defined(__APPLE__)
+	if(options.affinityMask)
+		LOG(WARNING) << "Thread affinity masks are not supported on Mac OSX.";
+
+	if(options.priority != Awesomium::TP_NORMAL)
+	{
+		int policy;
+		sched_param param;
+		pthread_getschedparam(pthread_self(), &policy, &param);
+
+		int minPriority = sched_get_priority_min(policy);
+		int maxPriority = sched_get_priority_max(policy);
+
+		// Spread our five levels evenly over the policy's range, TP_NORMAL is the middle
+		param.sched_priority = minPriority + (maxPriority - minPriority) * options.priority / Awesomium::TP_HIGHEST;
+
+		if(pthread_setschedparam(pthread_self(), policy, &param))
+			LOG(WARNING) << "Could not set the thread priority.";
+	}
+#else
+	if(options.affinityMask)
+	{
+		cpu_set_t cpuSet;
+		CPU_ZERO(&cpuSet);
+
+		for(int i = 0; i < 64 && i < CPU_SETSIZE; i++)
+			if(options.affinityMask & (1ULL << i))
+				CPU_SET(i, &cpuSet);
+
+		if(pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet))
+			LOG(WARNING) << "Could not set the thread affinity mask.";
+	}
+
+	if(options.priority != Awesomium::TP_NORMAL)
+	{
+		// Linux threads don't have priorities under the default policy, but each has its own nice value
+		static const int niceValues[] = { 10, 5, 0, -5, -10 };
+
+		if(setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), niceValues[options.priority]))
+			LOG(WARNING) << "Could not set the thread priority (raising it requires privileges).";
+	}
+#endif
+}
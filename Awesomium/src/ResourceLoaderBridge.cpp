@@ -49,6 +49,9 @@
 #include "net/url_request/url_request.h"
 #include "webkit/glue/resource_loader_bridge.h"
 #include "RequestContext.h"
+#include "WebCore.h"
+#include "PlatformUtils.h"
+#include "base/platform_thread.h"
 
 using webkit_glue::ResourceLoaderBridge;
 using net::HttpResponseHeaders;
@@ -63,6 +66,10 @@ namespace {
 	
 	URLRequestContext* request_context = NULL;
 	base::Thread* io_thread = NULL;
+	// xAJS begin:
+	Awesomium::ThreadOptions io_thread_options;
+	Awesomium::ThreadObserver* io_thread_observer = NULL;
+	// xAJS end
 	
 	class IOThread : public base::Thread {
 	public:
@@ -75,7 +82,21 @@ namespace {
 			Stop();
 		}
 		
+		// xAJS begin:
+		virtual void Init() {
+			Impl::applyThreadOptions(io_thread_options);
+			
+			if (io_thread_observer)
+				io_thread_observer->onThreadStarted(thread_name(), (int)PlatformThread::CurrentId());
+		}
+		// xAJS end
+		
 		virtual void CleanUp() {
+			// xAJS begin:
+			if (io_thread_observer)
+				io_thread_observer->onThreadStopping(thread_name(), (int)PlatformThread::CurrentId());
+			// xAJS end
+			
 			if (request_context) {
 				request_context->Release();
 				request_context = NULL;
@@ -93,6 +114,7 @@ namespace {
 		io_thread = new IOThread();
 		base::Thread::Options options;
 		options.message_loop_type = MessageLoop::TYPE_IO;
+		options.stack_size = io_thread_options.stackSize; // xAJS
 		return io_thread->StartWithOptions(options);
 	}
 	
@@ -611,6 +633,16 @@ void SimpleResourceLoaderBridge::Init(URLRequestContext* context) {
 	// xAJS end
 }
 
+// xAJS begin:
+// static
+void SimpleResourceLoaderBridge::SetIOThreadOptions(const Awesomium::ThreadOptions& options, Awesomium::ThreadObserver* observer) {
+	DCHECK(!io_thread) << "the IO thread has already been started";
+	
+	io_thread_options = options;
+	io_thread_observer = observer;
+}
+// xAJS end
+
 // static
 void SimpleResourceLoaderBridge::Shutdown() {
 	if (io_thread) {
@@ -26,19 +26,66 @@
 #include "WebCore.h"
 #include "WebCoreProxy.h"
 #include "WebViewEvent.h"
+#include "ResourceLoaderBridge.h"
 #include "base/lock.h"
+#include "base/condition_variable.h"
 #include "base/thread.h"
 #include "base/at_exit.h"
 #include "base/path_service.h"
 #include "base/file_util.h"
 #include "base/message_loop.h"
+#include "base/time.h"
+#include "base/platform_thread.h"
+#include <algorithm>
 
 Awesomium::WebCore* Awesomium::WebCore::instance = 0;
 static MessageLoop* messageLoop = 0;
 
+/**
+* The thread that WebKit runs on, applies its ThreadOptions and notifies the ThreadObserver.
+*/
+class CoreThread : public base::Thread
+{
+public:
+	CoreThread(const Awesomium::ThreadOptions& options, Awesomium::ThreadObserver* observer) : base::Thread("CoreThread"), 
+		options(options), observer(observer)
+	{
+	}
+
+	~CoreThread()
+	{
+		// Stop here rather than in our base class, so that our CleanUp is called
+		Stop();
+	}
+
+	virtual void Init()
+	{
+		Impl::applyThreadOptions(options);
+
+		if(observer)
+			observer->onThreadStarted(thread_name(), (int)PlatformThread::CurrentId());
+	}
+
+	virtual void CleanUp()
+	{
+		if(observer)
+			observer->onThreadStopping(thread_name(), (int)PlatformThread::CurrentId());
+	}
+
+protected:
+	Awesomium::ThreadOptions options;
+	Awesomium::ThreadObserver* observer;
+};
+
 namespace Awesomium {
 
-WebCore::WebCore(LogLevel level, bool enablePlugins, PixelFormat pixelFormat ) : pluginsEnabled(enablePlugins), pixelFormat(pixelFormat)
+ThreadOptions::ThreadOptions() : affinityMask(0), priority(TP_NORMAL), stackSize(0)
+{
+}
+
+WebCore::WebCore(LogLevel level, bool enablePlugins, PixelFormat pixelFormat, bool enableSingleThreaded, const ThreadOptions& coreThreadOptions,
+				 const ThreadOptions& ioThreadOptions, ThreadObserver* threadObserver) : updateThreadID((int)PlatformThread::CurrentId()), 
+	pluginsEnabled(enablePlugins), pixelFormat(pixelFormat), singleThreaded(enableSingleThreaded)
 {
 	assert(!instance);
 	instance = this;
@@ -69,49 +116,104 @@ WebCore::WebCore(LogLevel level, bool enablePlugins, PixelFormat pixelFormat ) :
 	eventQueueLock = new Lock();
 	baseDirLock = new Lock();
 	customResponsePageLock = new Lock();
+	waiterLock = new Lock();
+	waiterExecutor = 0;
+
+	for(int i = 0; i < kNumViewShards; i++)
+	{
+		viewShardLocks[i] = new Lock();
+		viewShardConditions[i] = new ConditionVariable(viewShardLocks[i]);
+	}
 	
 	messageLoop = new MessageLoop();
 
-	LOG(INFO) << "Creating the core thread.";
-	coreThread = new base::Thread("CoreThread");
+	if(singleThreaded)
+	{
+		// WebKit shares our message loop, it is pumped by WebCore::update
+		LOG(INFO) << "Running in single-threaded mode, no core thread will be created.";
+		coreThread = 0;
+		coreLoop = messageLoop;
+	}
+	else
+	{
+		LOG(INFO) << "Creating the core thread.";
+		coreThread = new CoreThread(coreThreadOptions, threadObserver);
 #if defined(_WIN32)
-	// An internal message loop type of UI seems to be required on
-	// Windows for proper clipboard functionality
-	coreThread->StartWithOptions(base::Thread::Options(MessageLoop::TYPE_UI, 0));
+		// An internal message loop type of UI seems to be required on
+		// Windows for proper clipboard functionality
+		coreThread->StartWithOptions(base::Thread::Options(MessageLoop::TYPE_UI, coreThreadOptions.stackSize));
 #else
-	coreThread->Start();
+		coreThread->StartWithOptions(base::Thread::Options(MessageLoop::TYPE_DEFAULT, coreThreadOptions.stackSize));
 #endif
+		coreLoop = coreThread->message_loop();
+	}
+
+	// The IO thread is started lazily, by the first request
+	SimpleResourceLoaderBridge::SetIOThreadOptions(ioThreadOptions, threadObserver);
 
 	LOG(INFO) << "Creating the WebCore.";
-	coreProxy = new WebCoreProxy(coreThread, pluginsEnabled);
+	coreProxy = new WebCoreProxy(coreLoop, pluginsEnabled, singleThreaded);
 	Impl::initWebCorePlatform();
 	coreProxy->AddRef();
-	coreProxy->startup();
+
+	// In single-threaded mode, start up right away so that inline calls made before the first update find us online
+	if(singleThreaded)
+		coreProxy->asyncStartup();
+	else
+		coreProxy->startup();
 }
 
 WebCore::~WebCore()
 {
 	assert(instance);
 
-	if(views.size())
-	{
-		std::vector<WebView*> viewsToDestroy(views);
+	std::vector<WebView*> viewsToDestroy;
 
-		for(std::vector<WebView*>::iterator i = viewsToDestroy.begin(); i != viewsToDestroy.end();)
-		{
-			(*i)->destroy();
-			i = viewsToDestroy.erase(i);
-		}
+	for(int i = 0; i < kNumViewShards; i++)
+	{
+		AutoLock autoShardLock(*viewShardLocks[i]);
+		viewsToDestroy.insert(viewsToDestroy.end(), viewShards[i].begin(), viewShards[i].end());
 	}
+
+	for(std::vector<WebView*>::iterator i = viewsToDestroy.begin(); i != viewsToDestroy.end(); i++)
+		(*i)->destroy();
 	
 	messageLoop->RunAllPending();
+
+	if(singleThreaded)
+	{
+		LOG(INFO) << "Releasing the WebCore.";
+		coreProxy->Release();
+		messageLoop->RunAllPending();
+	}
+
 	delete messageLoop;
 
-	LOG(INFO) << "Releasing the WebCore soon.";
-	coreThread->message_loop()->ReleaseSoon(FROM_HERE, coreProxy);
-	LOG(INFO) << "Destroying the core thread.";
-	delete coreThread;
-	LOG(INFO) << "The core thread has been destroyed.";
+	// Events that were left over by a time-budgeted update
+	for(int i = 0; i < WebViewEvent::NUM_PRIORITIES; i++)
+	{
+		while(!pendingEvents[i].empty())
+		{
+			delete pendingEvents[i].front();
+			pendingEvents[i].pop_front();
+		}
+	}
+
+	if(!singleThreaded)
+	{
+		LOG(INFO) << "Releasing the WebCore soon.";
+		coreThread->message_loop()->ReleaseSoon(FROM_HERE, coreProxy);
+		LOG(INFO) << "Destroying the core thread.";
+		delete coreThread;
+		LOG(INFO) << "The core thread has been destroyed.";
+	}
+	for(int i = 0; i < kNumViewShards; i++)
+	{
+		delete viewShardConditions[i];
+		delete viewShardLocks[i];
+	}
+
+	delete waiterLock;
 	delete customResponsePageLock;
 	delete eventQueueLock;
 	delete baseDirLock;
@@ -151,9 +253,12 @@ void WebCore::setBaseDirectory(const std::string& baseDirectory)
 
 Awesomium::WebView* WebCore::createWebView(int width, int height, bool isTransparent, bool enableAsyncRendering, int maxAsyncRenderPerSec)
 {
-	Awesomium::WebView* view = new Awesomium::WebView(width, height, isTransparent, enableAsyncRendering, maxAsyncRenderPerSec, coreThread);
+	Awesomium::WebView* view = new Awesomium::WebView(width, height, isTransparent, enableAsyncRendering, maxAsyncRenderPerSec, coreLoop, singleThreaded);
 
-	views.push_back(view);
+	{
+		AutoLock autoShardLock(*viewShardLocks[getViewShard(view)]);
+		viewShards[getViewShard(view)].push_back(view);
+	}
 
 	view->startup();
 
@@ -167,24 +272,97 @@ void WebCore::setCustomResponsePage(int statusCode, const std::string& filePath)
 	customResponsePageMap[statusCode] = filePath;
 }
 
-void WebCore::update()
+int WebCore::update(int maxMicroseconds)
 {
+	// Our message loop belongs to the thread that created us
+	DCHECK((int)PlatformThread::CurrentId() == updateThreadID) << "WebCore::update must be called from the thread that created the WebCore";
+
+	base::TimeTicks startTime;
+	if(maxMicroseconds > 0)
+		startTime = base::TimeTicks::HighResNow();
+
 	messageLoop->RunAllPending();
-	std::deque<WebViewEvent*> eventQueueCopy;
 
 	{
 		AutoLock autoQueueLock(*eventQueueLock);
-		eventQueue.swap(eventQueueCopy);
+
+		// Sort the new arrivals into their classes, order is preserved within each class
+		for(std::deque<WebViewEvent*>::iterator i = eventQueue.begin(); i != eventQueue.end(); i++)
+			pendingEvents[(*i)->getPriority()].push_back(*i);
+
+		eventQueue.clear();
 	}
 
-	while(!eventQueueCopy.empty())
+	while(true)
 	{
-		WebViewEvent* event = eventQueueCopy.front();
-		event->run();
+		WebViewEvent* event = 0;
+		bool isViewAlive;
+
+		{
+			AutoLock autoQueueLock(*eventQueueLock);
+
+			// Always start from the top, a re-entrant update may have sorted new arrivals into a higher class
+			int priority = 0;
+			while(priority < WebViewEvent::NUM_PRIORITIES && pendingEvents[priority].empty())
+				priority++;
+
+			if(priority == WebViewEvent::NUM_PRIORITIES)
+				break;
+
+			// Pop before running, a listener may re-enter update
+			event = pendingEvents[priority].front();
+			pendingEvents[priority].pop_front();
+
+			// Make sure that the view isn't destroyed by another thread while its listener is running. This is done
+			// before letting go of the queue, the view can't be deleted until its events have been purged from it.
+			isViewAlive = beginDispatch(event->getView());
+		}
+
+		// (A view that was unregistered after the event was popped is being destroyed, drop its event.)
+		if(isViewAlive)
+		{
+			event->run();
+			endDispatch();
+		}
+
 		delete event;
 
-		eventQueueCopy.pop_front();
+		if(maxMicroseconds > 0 && (base::TimeTicks::HighResNow() - startTime).InMicroseconds() >= maxMicroseconds)
+			break;
 	}
+
+	resumeReadyWaiters();
+
+	AutoLock autoQueueLock(*eventQueueLock);
+
+	int backlog = 0;
+	for(int i = 0; i < WebViewEvent::NUM_PRIORITIES; i++)
+		backlog += (int)pendingEvents[i].size();
+
+	return backlog;
+}
+
+void WebCore::addWaiter(Waiter* waiter)
+{
+	AutoLock autoWaiterLock(*waiterLock);
+
+	waiters.push_back(waiter);
+}
+
+void WebCore::removeWaiter(Waiter* waiter)
+{
+	AutoLock autoWaiterLock(*waiterLock);
+
+	std::vector<Waiter*>::iterator i = std::find(waiters.begin(), waiters.end(), waiter);
+	if(i != waiters.end())
+		waiters.erase(i);
+}
+
+void WebCore::setWaiterExecutor(WaiterExecutor* executor)
+{
+	AutoLock autoWaiterLock(*waiterLock);
+
+	waiterExecutor = executor;
 }
 
 const std::string& WebCore::getBaseDirectory() const
@@ -204,36 +382,204 @@ bool WebCore::arePluginsEnabled() const
 	return pluginsEnabled;
 }
 
+bool WebCore::isSingleThreaded() const
+{
+	return singleThreaded;
+}
+
+int WebCore::getNumCoreWakeups() const
+{
+	return coreProxy->getNumWakeups();
+}
+
 void WebCore::pause()
 {
-	coreProxy->pause();
+	if(!singleThreaded)
+		coreProxy->pause();
 }
 
 void WebCore::resume()
 {
-	coreProxy->resume();
+	if(!singleThreaded)
+		coreProxy->resume();
 }
 
 void WebCore::queueEvent(WebViewEvent* event)
 {
 	AutoLock autoQueueLock(*eventQueueLock);
 
-	eventQueue.push_front(event);
+	eventQueue.push_back(event);
 }
 
-void WebCore::removeWebView(WebView* view)
+/**
+* Deletes the events in a queue that reference a certain WebView.
+*/
+static void purgeEvents(std::deque<WebViewEvent*>& queue, Awesomium::WebView* view)
+{
+	for(std::deque<WebViewEvent*>::iterator i = queue.begin(); i != queue.end();)
+	{
+		if((*i)->getView() == view)
+		{
+			delete *i;
+			i = queue.erase(i);
+		}
+		else
+		{
+			i++;
+		}
+	}
+}
+
+void WebCore::resumeReadyWaiters()
 {
-	// Parse event queue in case one of the events references this view
-	update();
+	std::vector<Waiter*> readyWaiters;
+	WaiterExecutor* executor;
 
-	for(std::vector<WebView*>::iterator i = views.begin(); i != views.end(); i++)
 	{
-		if((*i) == view)
+		AutoLock autoWaiterLock(*waiterLock);
+
+		if(waiters.empty())
+			return;
+
+		for(std::vector<Waiter*>::iterator i = waiters.begin(); i != waiters.end();)
 		{
-			views.erase(i);
-			break;
+			if((*i)->isReady())
+			{
+				readyWaiters.push_back(*i);
+				i = waiters.erase(i);
+			}
+			else
+			{
+				i++;
+			}
 		}
+
+		executor = waiterExecutor;
+	}
+
+	// Resume outside of the lock, a resumed coroutine will usually register its next Waiter right away
+	for(std::vector<Waiter*>::iterator i = readyWaiters.begin(); i != readyWaiters.end(); i++)
+	{
+		if(executor)
+			executor->execute(*i);
+		else
+			(*i)->resume();
+	}
+}
+
+/**
+* Unregisters a WebView that is being destroyed. Once this returns, no other thread is using the
+* view through the registry (see WebCore::pinWebView) or running one of its events (see
+* WebCore::beginDispatch), and none of its queued events will run.
+*/
+void WebCore::removeWebView(WebView* view)
+{
+	int shardIndex = getViewShard(view);
+
+	{
+		AutoLock autoShardLock(*viewShardLocks[shardIndex]);
+		std::vector<WebView*>& shard = viewShards[shardIndex];
+
+		std::vector<WebView*>::iterator i = std::find(shard.begin(), shard.end(), view);
+		if(i != shard.end())
+			shard.erase(i);
+
+		// Nobody can pin it anymore, wait for those that already did. A listener that destroys its
+		// own view is fine, the event doesn't touch the view after running.
+		bool isUpdateThread = (int)PlatformThread::CurrentId() == updateThreadID;
+		while(view->pinCount || (view->dispatchCount && !isUpdateThread))
+			viewShardConditions[shardIndex]->Wait();
+
+		// Let WebCore::endDispatch know that the view is gone, its address may be reused right away
+		if(isUpdateThread)
+			std::replace(dispatchStack.begin(), dispatchStack.end(), view, (WebView*)0);
+	}
+
+	purgeWebViewEvents(view);
+}
+
+/**
+* Discards the queued events that reference a WebView. Events that WebCore::update has already
+* popped are dropped by it, the view is no longer registered.
+*/
+void WebCore::purgeWebViewEvents(WebView* view)
+{
+	AutoLock autoQueueLock(*eventQueueLock);
+
+	purgeEvents(eventQueue, view);
+	for(int i = 0; i < WebViewEvent::NUM_PRIORITIES; i++)
+		purgeEvents(pendingEvents[i], view);
+}
+
+/**
+* Keeps a WebView from being destroyed until the matching WebCore::unpinWebView. Returns false,
+* without pinning it, if the view has already been destroyed (or is being destroyed).
+*/
+bool WebCore::pinWebView(WebView* view)
+{
+	AutoLock autoShardLock(*viewShardLocks[getViewShard(view)]);
+	std::vector<WebView*>& shard = viewShards[getViewShard(view)];
+
+	if(std::find(shard.begin(), shard.end(), view) == shard.end())
+		return false;
+
+	view->pinCount++;
+
+	return true;
+}
+
+void WebCore::unpinWebView(WebView* view)
+{
+	int shardIndex = getViewShard(view);
+	AutoLock autoShardLock(*viewShardLocks[shardIndex]);
+
+	if(!--view->pinCount)
+		viewShardConditions[shardIndex]->Broadcast();
+}
+
+/**
+* Marks an event of a WebView as being run by WebCore::update, so that the WebView can't be
+* destroyed by another thread until the matching WebCore::endDispatch. Returns false if the view
+* has already been unregistered. Events that don't reference a WebView are always run.
+*/
+bool WebCore::beginDispatch(WebView* view)
+{
+	if(view)
+	{
+		AutoLock autoShardLock(*viewShardLocks[getViewShard(view)]);
+		std::vector<WebView*>& shard = viewShards[getViewShard(view)];
+
+		if(std::find(shard.begin(), shard.end(), view) == shard.end())
+			return false;
+
+		view->dispatchCount++;
 	}
+
+	dispatchStack.push_back(view);
+
+	return true;
+}
+
+void WebCore::endDispatch()
+{
+	WebView* view = dispatchStack.back();
+	dispatchStack.pop_back();
+
+	// Nothing to do for events without a WebView, or if the listener destroyed its own view
+	if(!view)
+		return;
+
+	int shardIndex = getViewShard(view);
+	AutoLock autoShardLock(*viewShardLocks[shardIndex]);
+
+	if(!--view->dispatchCount)
+		viewShardConditions[shardIndex]->Broadcast();
+}
+
+int WebCore::getViewShard(WebView* view) const
+{
+	// The low bits of a heap address carry no information
+	return (int)((reinterpret_cast<size_t>(view) >> 4) % kNumViewShards);
 }
 
 void WebCore::purgePluginMessages()
@@ -242,16 +588,53 @@ void WebCore::purgePluginMessages()
 		coreProxy->purgePluginMessages();
 }
 
-void WebCore::resolveJSValueFuture(WebView* view, int requestID, JSValue* result)
+void WebCore::pluginCreated()
+{
+	coreProxy->addPlugin();
+}
+
+void WebCore::pluginDestroyed()
+{
+	coreProxy->removePlugin();
+}
+
+bool WebCore::resolveJSValueFuture(WebView* view, int requestID, JSValue* result, JSError* error, int timeoutMilliseconds)
 {
-	for(std::vector<WebView*>::iterator i = views.begin(); i != views.end(); i++)
+	// The future may have outlived its WebView, otherwise make sure that it can't be destroyed while we wait on it
+	if(pinWebView(view))
 	{
-		if((*i) == view)
-		{
-			view->resolveJSValueFuture(requestID, result);
-			return;
-		}
+		bool isResolved = view->resolveJSValueFuture(requestID, result, error, timeoutMilliseconds);
+		unpinWebView(view);
+
+		return isResolved;
+	}
+
+	*result = JSValue();
+	*error = JSError("The WebView was destroyed before the value was computed.");
+
+	return true;
+}
+
+bool WebCore::isJSValueFutureResolved(WebView* view, int requestID)
+{
+	if(!pinWebView(view))
+		return true;
+
+	bool isResolved = view->isJSValueFutureResolved(requestID);
+	unpinWebView(view);
+
+	return isResolved;
+}
+
+void WebCore::setJSValueFutureHandler(WebView* view, int requestID, FutureJSValueHandler* handler)
+{
+	if(pinWebView(view))
+	{
+		view->setJSValueFutureHandler(requestID, handler);
+		unpinWebView(view);
 	}
+	else
+		queueEvent(new WebViewEvents::ResolveFuture(0, handler, JSValue(), JSError("The WebView was destroyed before the value was computed.")));
 }
 
 void WebCore::getCustomResponsePage(int statusCode, std::string& filePathResult)
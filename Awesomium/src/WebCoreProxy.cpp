@@ -24,7 +24,8 @@
 */
 
 #include "WebCoreProxy.h"
-#include "base/thread.h"
+#include "WebViewProxy.h"
+#include "base/message_loop.h"
 #include "ResourceLoaderBridge.h"
 #include "RequestContext.h"
 #include "base/icu_util.h"
@@ -72,8 +73,8 @@ public:
 	}
 };
 
-WebCoreProxy::WebCoreProxy(base::Thread* coreThread, bool pluginsEnabled) : coreThread(coreThread),
-	pluginsEnabled(pluginsEnabled), threadWaitEvent(false, false), pauseRequestEvent(false, false)
+WebCoreProxy::WebCoreProxy(MessageLoop* coreLoop, bool pluginsEnabled, bool sharesHostThread) : coreLoop(coreLoop),
+	pluginsEnabled(pluginsEnabled), sharesHostThread(sharesHostThread), numPlugins(0), numWakeups(0), schedulerVirtualTime(0), isSchedulerPending(false), threadWaitEvent(false, false), pauseRequestEvent(false, false)
 {
 	static bool icuLoaded = false;
 
@@ -111,7 +112,7 @@ WebCoreProxy::~WebCoreProxy()
 	LOG(INFO) << "Destroying the WebCore.";
 	
 #if defined(WIN32)
-	if(pluginsEnabled)
+	if(pluginsEnabled && !sharesHostThread)
 	{
 		throttledMessages.clear();
 
@@ -128,12 +129,12 @@ WebCoreProxy::~WebCoreProxy()
 
 void WebCoreProxy::startup()
 {
-	coreThread->message_loop()->PostTask(FROM_HERE, NewRunnableMethod(this, &WebCoreProxy::asyncStartup));
+	coreLoop->PostTask(FROM_HERE, NewRunnableMethod(this, &WebCoreProxy::asyncStartup));
 }
 
 void WebCoreProxy::pause()
 {
-	coreThread->message_loop()->PostTask(FROM_HERE, NewRunnableMethod(this, &WebCoreProxy::asyncPause));
+	coreLoop->PostTask(FROM_HERE, NewRunnableMethod(this, &WebCoreProxy::asyncPause));
 	pauseRequestEvent.Wait();
 }
 
@@ -149,6 +150,143 @@ void WebCoreProxy::resume()
 	threadWaitEvent.Signal();
 }
 
+/**
+* Called on the core thread whenever a WindowlessPlugin is created. The plugin message pump
+* only runs while at least one plugin exists so that an idle core thread can sleep.
+*/
+void WebCoreProxy::addPlugin()
+{
+	// When we share the host's thread, the host's own message pump already dispatches plugin window messages
+	if(++numPlugins == 1 && pluginsEnabled && !sharesHostThread)
+		pluginMessageTimer.Start(base::TimeDelta::FromMilliseconds(10), this, &WebCoreProxy::pumpPluginMessages);
+}
+
+void WebCoreProxy::removePlugin()
+{
+	if(numPlugins && --numPlugins == 0)
+		pluginMessageTimer.Stop();
+}
+
+/**
+* Called on the core thread from each entry point that timers and posted work wake us up for.
+*/
+void WebCoreProxy::countWakeup()
+{
+	base::subtle::NoBarrier_AtomicIncrement(&numWakeups, 1);
+}
+
+int WebCoreProxy::getNumWakeups()
+{
+	return base::subtle::NoBarrier_Load(&numWakeups);
+}
+
+// The most commands a WebView may run before the scheduler picks again
+static const int kCommandsPerSlice = 32;
+
+// The longest a single scheduling pass may run before yielding to the rest of the message loop
+static const int kMaxPassMicroseconds = 4000;
+
+/**
+* Called from any thread when a WebView has commands ready to run on the core thread.
+*
+* Ready WebViews are run by runScheduledViews in weighted-fair order: each is charged for the time
+* it uses, divided by its weight, and the one that has been charged the least goes next.
+*/
+void WebCoreProxy::scheduleView(WebViewProxy* view)
+{
+	bool needsPass = false;
+
+	{
+		AutoLock autoSchedulerLock(schedulerLock);
+
+		if(view->isScheduled)
+			return;
+
+		view->AddRef();
+		view->isScheduled = true;
+		view->readyTime = base::TimeTicks::Now();
+
+		// Don't let a WebView that has been idle bank up credit
+		if(view->virtualTime < schedulerVirtualTime)
+			view->virtualTime = schedulerVirtualTime;
+
+		readyViews.push_back(view);
+
+		needsPass = !isSchedulerPending;
+		isSchedulerPending = true;
+	}
+
+	if(needsPass)
+		coreLoop->PostTask(FROM_HERE, NewRunnableMethod(this, &WebCoreProxy::runScheduledViews));
+}
+
+void WebCoreProxy::runScheduledViews()
+{
+	countWakeup();
+
+	base::TimeTicks passStart = base::TimeTicks::Now();
+
+	while(true)
+	{
+		WebViewProxy* view = 0;
+		base::TimeDelta queueDelay;
+
+		{
+			AutoLock autoSchedulerLock(schedulerLock);
+
+			if(readyViews.empty())
+			{
+				isSchedulerPending = false;
+				return;
+			}
+
+			if((base::TimeTicks::Now() - passStart).InMicroseconds() >= kMaxPassMicroseconds)
+				break;
+
+			// Views with pending input always go first, otherwise pick the one with the least virtual time
+			std::vector<WebViewProxy*>::iterator next = readyViews.begin();
+			for(std::vector<WebViewProxy*>::iterator i = readyViews.begin(); i != readyViews.end(); i++)
+			{
+				bool hasInput = (*i)->hasPendingInput();
+				bool nextHasInput = (*next)->hasPendingInput();
+
+				if((hasInput && !nextHasInput) || (hasInput == nextHasInput && (*i)->virtualTime < (*next)->virtualTime))
+					next = i;
+			}
+
+			view = *next;
+			readyViews.erase(next);
+			view->isScheduled = false;
+			schedulerVirtualTime = view->virtualTime;
+			queueDelay = base::TimeTicks::Now() - view->readyTime;
+		}
+
+		base::TimeTicks sliceStart = base::TimeTicks::Now();
+		bool hasMore = view->runSlice(kCommandsPerSlice, queueDelay);
+		int64 cost = (base::TimeTicks::Now() - sliceStart).InMicroseconds() + 1;
+
+		{
+			AutoLock autoSchedulerLock(schedulerLock);
+
+			view->virtualTime += cost * WebViewProxy::kMaxWeight / view->weight;
+
+			// runSlice left the queue marked as pending, so nobody else will re-schedule it
+			if(hasMore && !view->isScheduled)
+			{
+				view->AddRef();
+				view->isScheduled = true;
+				view->readyTime = base::TimeTicks::Now();
+				readyViews.push_back(view);
+			}
+		}
+
+		view->Release();
+	}
+
+	// Yield so that timers and network tasks can run, we'll pick up where we left off
+	coreLoop->PostTask(FROM_HERE, NewRunnableMethod(this, &WebCoreProxy::runScheduledViews));
+}
+
 bool WebCoreProxy::sandboxEnabled() {
 	return false;
 }
@@ -252,14 +390,13 @@ void WebCoreProxy::asyncStartup()
 	initMacApplication();
 #endif
 
-	if(pluginsEnabled)
-		pluginMessageTimer.Start(base::TimeDelta::FromMilliseconds(10), this, &WebCoreProxy::pumpPluginMessages);
-
 	LOG(INFO) << "The WebCore is now online.";
 }
 
 void WebCoreProxy::pumpPluginMessages()
 {
+	countWakeup();
+
 #if defined(WIN32)
 	MSG msg;
 
@@ -270,7 +407,7 @@ void WebCoreProxy::pumpPluginMessages()
 			throttledMessages.push_back(msg);
 			
 			if(throttledMessages.size() == 1)
-				coreThread->message_loop()->PostDelayedTask(FROM_HERE, NewRunnableMethod(this, &WebCoreProxy::pumpThrottledMessages), 5);
+				coreLoop->PostDelayedTask(FROM_HERE, NewRunnableMethod(this, &WebCoreProxy::pumpThrottledMessages), 5);
 		}
 		else
 		{
@@ -302,6 +439,8 @@ void WebCoreProxy::pumpPluginMessages()
 
 void WebCoreProxy::pumpThrottledMessages()
 {
+	countWakeup();
+
 #if defined(WIN32)
 	if(!throttledMessages.size())
 		return;
@@ -313,7 +452,7 @@ void WebCoreProxy::pumpThrottledMessages()
 	DispatchMessage(&msg);
 
 	if(throttledMessages.size())
-		coreThread->message_loop()->PostDelayedTask(FROM_HERE, NewRunnableMethod(this, &WebCoreProxy::pumpThrottledMessages), 5);
+		coreLoop->PostDelayedTask(FROM_HERE, NewRunnableMethod(this, &WebCoreProxy::pumpThrottledMessages), 5);
 #endif
 }
 
@@ -322,6 +461,10 @@ void WebCoreProxy::purgePluginMessages()
 #if defined(WIN32)
 	throttledMessages.clear();
 
+	// Don't eat the host's messages
+	if(sharesHostThread)
+		return;
+
 	MSG msg;
 	while(PeekMessage(&msg, 0, NULL, NULL, PM_REMOVE))
 	{
@@ -27,30 +27,41 @@
 #include "WebViewProxy.h"
 #include "WebCore.h"
 #include "WebViewEvent.h"
+#include "WebViewCommand.h"
 
 #include "base/string_util.h"
 #include "base/waitable_event.h"
-#include "base/thread.h"
+#include "base/message_loop.h"
+#include "base/time.h"
 #include "base/lock.h"
+#include "base/atomicops.h"
+#include "base/ref_counted.h"
+#include <algorithm>
 
 class WebViewWaitState
 {
 public:
-	base::WaitableEvent renderEvent, shutdownEvent, getContentTextEvent, jsValueFutureEvent, resizeEvent;
+	base::WaitableEvent renderEvent, shutdownEvent, getContentTextEvent, resizeEvent;
 
 	WebViewWaitState() : renderEvent(false, false), shutdownEvent(false, false), getContentTextEvent(false, false),
-		jsValueFutureEvent(false, false), resizeEvent(false, false)
+		resizeEvent(false, false)
 	{
 	}
 };
 
-class JSValueFutureImpl
+/**
+* A pending request, the map it is registered in holds a reference. Callers that wait on it hold
+* another, so that it outlives its removal from the map by a FutureJSValue copy that got the value first.
+*/
+class JSValueFutureImpl : public base::RefCountedThreadSafe<JSValueFutureImpl>
 {
 public:
 	Awesomium::JSValue* value;
-	base::WaitableEvent resolveFutureEvent;
+	Awesomium::JSError error;
+	Awesomium::FutureJSValueHandler* handler;
+	base::WaitableEvent resolveFutureEvent; // stays signalled once resolved, there may be several waiters
 
-	JSValueFutureImpl() : value(0), resolveFutureEvent(false, false)
+	JSValueFutureImpl() : value(0), handler(0), resolveFutureEvent(true, false)
 	{
 	}
 
@@ -74,37 +85,70 @@ bool Awesomium::Rect::isEmpty() const
 	return !x && !y && !width && !height;
 }
 
-Awesomium::WebView::WebView(int width, int height, bool isTransparent, bool enableAsyncRendering, int maxAsyncRenderPerSec, base::Thread* coreThread)
-: coreThread(coreThread), listener(0), dirtiness(false), isKeyboardFocused(false), enableAsyncRendering(enableAsyncRendering)
+Awesomium::WebViewStats::WebViewStats() : numInputEventsInjected(0), numInputEventsCoalesced(0), numScheduledSlices(0),
+	averageQueueDelayMicroseconds(0), maxQueueDelayMicroseconds(0), numCommandsDropped(0), commandQueueHighWater(0)
+{
+}
+
+Awesomium::WebView::WebView(int width, int height, bool isTransparent, bool enableAsyncRendering, int maxAsyncRenderPerSec, MessageLoop* coreLoop, bool isCoreInline)
+: coreLoop(coreLoop), isCoreInline(isCoreInline), listener(0), consoleMessageHandler(0), dirtiness(false), isKeyboardFocused(false), batchDepth(0), numFinishedLoads(0), pinCount(0), dispatchCount(0), enableAsyncRendering(enableAsyncRendering)
 {
 	viewProxy = new WebViewProxy(width, height, isTransparent, enableAsyncRendering, maxAsyncRenderPerSec, this);
 	viewProxy->AddRef();
 
 	waitState = new WebViewWaitState();
 	dirtinessLock = new LockImpl();
-	jsValueFutureMapLock = new LockImpl();
+	ownedCallbackHandlersLock = new LockImpl();
+
+	for(int i = 0; i < kNumFutureShards; i++)
+		jsValueFutureLocks[i] = new LockImpl();
 
 	LOG(INFO) << "A new WebView has been created.";
 }
 
 Awesomium::WebView::~WebView()
 {
-	coreThread->message_loop()->PostTask(FROM_HERE, NewRunnableMethod(viewProxy, &WebViewProxy::asyncShutdown));
+	// Unregister before anything is torn down: this waits until no other thread is using us or running one of our events
+	// and purges our queued events
+	WebCore::Get().removeWebView(this);
+
+	postCommand(WebViewCommand::SHUTDOWN, true);
 	waitState->shutdownEvent.Wait();
+
+	// The core thread may have queued a few more events before it shut the proxy down
+	WebCore::Get().purgeWebViewEvents(this);
+
 	viewProxy->Release();
 
-	delete jsValueFutureMapLock;
+	// Futures that were never retrieved, their handlers are still owed a call
+	for(int i = 0; i < kNumFutureShards; i++)
+	{
+		for(std::map<int, JSValueFutureImpl*>::iterator j = jsValueFutureMaps[i].begin(); j != jsValueFutureMaps[i].end(); j++)
+		{
+			if(j->second->handler)
+				WebCore::Get().queueEvent(new WebViewEvents::ResolveFuture(0, j->second->handler, Awesomium::JSValue(), 
+					Awesomium::JSError("The WebView was destroyed before the value was computed.")));
+
+			j->second->Release();
+		}
+
+		delete jsValueFutureLocks[i];
+	}
+
+	// None of our events can run anymore, so nothing points to these
+	for(std::vector<CallbackHandler*>::iterator i = ownedCallbackHandlers.begin(); i != ownedCallbackHandlers.end(); i++)
+		delete *i;
+
+	delete ownedCallbackHandlersLock;
 	delete dirtinessLock;
 	delete waitState;
 
-	WebCore::Get().removeWebView(this);
-
 	LOG(INFO) << "A WebView has been destroyed.";
 }
 
 void Awesomium::WebView::startup()
 {
-	coreThread->message_loop()->PostTask(FROM_HERE, NewRunnableMethod(viewProxy, &WebViewProxy::asyncStartup));
+	postCommand(WebViewCommand::STARTUP);
 }
 
 void Awesomium::WebView::destroy()
@@ -122,75 +166,214 @@ Awesomium::WebViewListener* Awesomium::WebView::getListener()
 	return listener;
 }
 
+void Awesomium::WebView::setConsoleMessageHandler(Awesomium::ConsoleMessageHandler* handler)
+{
+	this->consoleMessageHandler = handler;
+}
+
+Awesomium::ConsoleMessageHandler* Awesomium::WebView::getConsoleMessageHandler()
+{
+	return consoleMessageHandler;
+}
+
+void Awesomium::WebView::beginBatch()
+{
+	batchDepth++;
+}
+
+void Awesomium::WebView::endBatch()
+{
+	if(batchDepth && --batchDepth == 0)
+		submitBatch();
+}
+
 void Awesomium::WebView::loadURL(const std::string& url, const std::wstring& frameName, const std::string& username, const std::string& password)
 {
-	coreThread->message_loop()->PostTask(FROM_HERE, NewRunnableMethod(viewProxy, &WebViewProxy::loadURL, url, frameName, username, password));
+	WebViewCommand& command = beginCommand(WebViewCommand::LOAD_URL);
+	command.stringArg[0] = url;
+	command.stringArg[1] = username;
+	command.stringArg[2] = password;
+	command.frameName = frameName;
+	endCommand();
 }
 
 void Awesomium::WebView::loadHTML(const std::string& html, const std::wstring& frameName)
 {
-	coreThread->message_loop()->PostTask(FROM_HERE, NewRunnableMethod(viewProxy, &WebViewProxy::loadHTML, html, frameName));
+	WebViewCommand& command = beginCommand(WebViewCommand::LOAD_HTML);
+	command.stringArg[0] = html;
+	command.frameName = frameName;
+	endCommand();
 }
 
 void Awesomium::WebView::loadFile(const std::string& file, const std::wstring& frameName)
 {
-	coreThread->message_loop()->PostTask(FROM_HERE, NewRunnableMethod(viewProxy, &WebViewProxy::loadFile, file, frameName));
+	WebViewCommand& command = beginCommand(WebViewCommand::LOAD_FILE);
+	command.stringArg[0] = file;
+	command.frameName = frameName;
+	endCommand();
 }
 
 void Awesomium::WebView::goToHistoryOffset(int offset)
 {
-	coreThread->message_loop()->PostTask(FROM_HERE, NewRunnableMethod(viewProxy, &WebViewProxy::goToHistoryOffset, offset));
+	WebViewCommand& command = beginCommand(WebViewCommand::GO_TO_HISTORY_OFFSET);
+	command.intArg[0] = offset;
+	endCommand();
 }
 
 void Awesomium::WebView::refresh()
 {
-	coreThread->message_loop()->PostTask(FROM_HERE, NewRunnableMethod(viewProxy, &WebViewProxy::refresh));
+	postCommand(WebViewCommand::REFRESH);
 }
 
 void Awesomium::WebView::executeJavascript(const std::string& javascript, const std::wstring& frameName)
 {
-	coreThread->message_loop()->PostTask(FROM_HERE, NewRunnableMethod(viewProxy, &WebViewProxy::executeJavascript, javascript, frameName));
+	WebViewCommand& command = beginCommand(WebViewCommand::EXECUTE_JAVASCRIPT);
+	command.stringArg[0] = javascript;
+	command.frameName = frameName;
+	endCommand();
 }
 
 Awesomium::FutureJSValue Awesomium::WebView::executeJavascriptWithResult(const std::string& javascript, const std::wstring& frameName)
 {
-	static int requestIDCounter = 0;
+	int requestID = createJSValueFutures(1);
 
 	FutureJSValue futureValue;
-	futureValue.init(this, ++requestIDCounter);
+	futureValue.init(this, requestID);
 
-	jsValueFutureMapLock->Lock();
-	jsValueFutureMap[requestIDCounter] = new JSValueFutureImpl();
-	jsValueFutureMapLock->Unlock();
+	// Someone will wait on the result, so this must never be dropped by the command queue's policy
+	WebViewCommand& command = beginCommand(WebViewCommand::EXECUTE_JAVASCRIPT_WITH_RESULT);
+	command.stringArg[0] = javascript;
+	command.frameName = frameName;
+	command.intArg[0] = requestID;
+	endCommand();
 
-	std::stringstream stream;
-	stream << "Client.____futureValue(" << requestIDCounter << ", eval(\"";
-	
-	for(std::string::const_iterator i = javascript.begin(); i != javascript.end(); i++)
-	{
-		if((*i) == '"')
-			stream << "\\\"";
-		else if((*i) == '\\')
-			stream << "\\\\";
-		else
-			stream << (*i);
-	}
+	return futureValue;
+}
+
+std::vector<Awesomium::FutureJSValue> Awesomium::WebView::evaluateBatch(const std::vector<std::string>& expressions, const std::wstring& frameName)
+{
+	std::vector<FutureJSValue> futureValues(expressions.size());
+
+	if(expressions.empty())
+		return futureValues;
+
+	int firstRequestID = createJSValueFutures((int)expressions.size());
 
-	stream << "\"))";
+	for(size_t i = 0; i < futureValues.size(); i++)
+		futureValues[i].init(this, (int)((unsigned int)firstRequestID + i));
+
+	// Someone will wait on the results, so this must never be dropped by the command queue's policy
+	WebViewCommand& command = beginCommand(WebViewCommand::EVALUATE_BATCH);
+	command.stringList = expressions;
+	command.frameName = frameName;
+	command.intArg[0] = firstRequestID;
+	endCommand();
+
+	return futureValues;
+}
+
+Awesomium::JSFunction Awesomium::WebView::compileFunction(const std::string& source, const std::wstring& frameName)
+{
+	// Shared by all WebViews, which may be driven from different threads
+	static base::subtle::Atomic32 functionIDCounter = 0;
+	int functionID = base::subtle::NoBarrier_AtomicIncrement(&functionIDCounter, 1);
+
+	JSFunction function;
+	function.init(this, functionID);
+
+	WebViewCommand& command = beginCommand(WebViewCommand::COMPILE_FUNCTION);
+	command.stringArg[0] = source;
+	command.frameName = frameName;
+	command.intArg[0] = functionID;
+	endCommand();
+
+	return function;
+}
+
+Awesomium::FutureJSValue Awesomium::WebView::invokeFunction(int functionID, const Awesomium::JSArguments& args)
+{
+	int requestID = createJSValueFutures(1);
+
+	FutureJSValue futureValue;
+	futureValue.init(this, requestID);
 
-	executeJavascript(stream.str(), frameName);
+	WebViewCommand& command = beginCommand(WebViewCommand::INVOKE_FUNCTION);
+	command.value.getArray() = args;
+	command.intArg[0] = functionID;
+	command.intArg[1] = requestID;
+	endCommand();
 
 	return futureValue;
 }
 
+void Awesomium::WebView::releaseFunction(int functionID)
+{
+	WebViewCommand& command = beginCommand(WebViewCommand::RELEASE_FUNCTION);
+	command.intArg[0] = functionID;
+	endCommand();
+}
+
 void Awesomium::WebView::setProperty(const std::string& name, const JSValue& value)
 {
-	coreThread->message_loop()->PostTask(FROM_HERE, NewRunnableMethod(viewProxy, &WebViewProxy::setProperty, name, value));
+	WebViewCommand& command = beginCommand(WebViewCommand::SET_PROPERTY, name);
+	command.stringArg[0] = name;
+	command.value = value;
+	endCommand();
 }
 
 void Awesomium::WebView::setCallback(const std::string& name)
 {
-	coreThread->message_loop()->PostTask(FROM_HERE, NewRunnableMethod(viewProxy, &WebViewProxy::setCallback, name));
+	registerCallback(name, 0, 0, false);
+}
+
+void Awesomium::WebView::setCallback(const std::string& name, CoreThreadCallback* handler)
+{
+	registerCallback(name, handler, 0, false);
+}
+
+void Awesomium::WebView::setCallback(const std::string& name, CallbackHandler* handler)
+{
+	registerCallback(name, 0, handler, false);
+}
+
+/**
+* The handlers are resolved by name once, here; each invocation of the callback then carries
+* its handler along (see WebViewEvents::InvokeCallback).
+*/
+void Awesomium::WebView::registerCallback(const std::string& name, CoreThreadCallback* coreThreadHandler, CallbackHandler* handler, bool isHandlerOwned)
+{
+	if(isHandlerOwned)
+	{
+		ownedCallbackHandlersLock->Lock();
+		ownedCallbackHandlers.push_back(handler);
+		ownedCallbackHandlersLock->Unlock();
+	}
+
+	WebViewCommand& command = beginCommand(WebViewCommand::SET_CALLBACK);
+	command.stringArg[0] = name;
+	command.pointerArg[0] = coreThreadHandler;
+	command.pointerArg[1] = handler;
+	endCommand();
+}
+
+void Awesomium::WebView::setCallbackPolicy(const std::string& name, Awesomium::CallbackPolicy policy, int maxPerSecond)
+{
+	if(policy == Awesomium::CALLBACK_POLICY_RATE_LIMIT && maxPerSecond <= 0)
+		LOG(WARNING) << "WebView::setCallbackPolicy: no limit was given for the rate-limited callback '" << name << "', it won't be limited.";
+
+	WebViewCommand& command = beginCommand(WebViewCommand::SET_CALLBACK_POLICY, name);
+	command.stringArg[0] = name;
+	command.intArg[0] = policy;
+	command.intArg[1] = maxPerSecond;
+	endCommand();
+}
+
+void Awesomium::WebView::setCallbackReceivesBuffers(const std::string& name, bool receivesBuffers)
+{
+	WebViewCommand& command = beginCommand(WebViewCommand::SET_CALLBACK_RECEIVES_BUFFERS, name);
+	command.stringArg[0] = name;
+	command.intArg[0] = receivesBuffers;
+	endCommand();
 }
 
 bool Awesomium::WebView::isDirty()
@@ -220,122 +403,263 @@ void Awesomium::WebView::render(unsigned char* destination, int destRowSpan, int
 	}
 	else
 	{
-		coreThread->message_loop()->PostTask(FROM_HERE, NewRunnableMethod(viewProxy, &WebViewProxy::renderSync, destination, destRowSpan, destDepth, renderedRect));
+		WebViewCommand& command = beginCommand(WebViewCommand::RENDER_SYNC);
+		command.pointerArg[0] = destination;
+		command.pointerArg[1] = renderedRect;
+		command.intArg[0] = destRowSpan;
+		command.intArg[1] = destDepth;
+		endCommand(true);
 		waitState->renderEvent.Wait();
 	}
 }
 
+void Awesomium::WebView::requestRender()
+{
+	if(!enableAsyncRendering)
+		postCommand(WebViewCommand::REQUEST_RENDER);
+}
+
+bool Awesomium::WebView::tryGetRenderedFrame(unsigned char* destination, int destRowSpan, int destDepth, Awesomium::Rect* renderedRect)
+{
+	if(enableAsyncRendering)
+	{
+		if(!isDirty())
+			return false;
+
+		viewProxy->copyRenderBuffer(destination, destRowSpan, destDepth);
+		return true;
+	}
+
+	return viewProxy->copyRenderedFrame(destination, destRowSpan, destDepth, renderedRect);
+}
+
 void Awesomium::WebView::injectMouseMove(int x, int y)
 {
-	coreThread->message_loop()->PostTask(FROM_HERE, NewRunnableMethod(viewProxy, &WebViewProxy::injectMouseMove, x, y));
+	QueuedInputEvent event(QueuedInputEvent::MOUSE_MOVE);
+	event.x = x;
+	event.y = y;
+
+	if(viewProxy->queueInput(event))
+		postInputFlush();
 }
 
 void Awesomium::WebView::injectMouseDown(Awesomium::MouseButton button)
 {
-	coreThread->message_loop()->PostTask(FROM_HERE, NewRunnableMethod(viewProxy, &WebViewProxy::injectMouseDown, (short)button));
+	QueuedInputEvent event(QueuedInputEvent::MOUSE_DOWN);
+	event.button = (short)button;
+
+	if(viewProxy->queueInput(event))
+		postInputFlush();
 }
 
 void Awesomium::WebView::injectMouseUp(Awesomium::MouseButton button)
 {
-	coreThread->message_loop()->PostTask(FROM_HERE, NewRunnableMethod(viewProxy, &WebViewProxy::injectMouseUp, (short)button));
+	QueuedInputEvent event(QueuedInputEvent::MOUSE_UP);
+	event.button = (short)button;
+
+	if(viewProxy->queueInput(event))
+		postInputFlush();
 }
 
 void Awesomium::WebView::injectMouseWheelXY(int scrollAmountX, int scrollAmountY)
 {
-	coreThread->message_loop()->PostTask(FROM_HERE, NewRunnableMethod(viewProxy, &WebViewProxy::injectMouseWheel, scrollAmountX, scrollAmountY));
+	QueuedInputEvent event(QueuedInputEvent::MOUSE_WHEEL);
+	event.x = scrollAmountX;
+	event.y = scrollAmountY;
+
+	if(viewProxy->queueInput(event))
+		postInputFlush();
 }
 
 void Awesomium::WebView::injectKeyEvent(bool press, int modifiers, int windowsCode, int nativeCode)
 {
-	coreThread->message_loop()->PostTask(FROM_HERE, NewRunnableMethod(viewProxy, &WebViewProxy::injectKeyEvent, press, modifiers, windowsCode, nativeCode));
+	QueuedInputEvent event(QueuedInputEvent::KEY);
+	event.press = press;
+	event.modifiers = modifiers;
+	event.windowsCode = windowsCode;
+	event.nativeCode = nativeCode;
+
+	if(viewProxy->queueInput(event))
+		postInputFlush();
 }
 
 void Awesomium::WebView::injectTextEvent(std::wstring text)
 {
 	// Webkit uses utf-16...
-	string16 output = WideToUTF16(text);
-	coreThread->message_loop()->PostTask(FROM_HERE, NewRunnableMethod(viewProxy, &WebViewProxy::injectTextEvent, output));
+	QueuedInputEvent event(QueuedInputEvent::TEXT);
+	event.text = WideToUTF16(text);
+
+	if(viewProxy->queueInput(event))
+		postInputFlush();
 }
 
 #if defined(_WIN32)
 void Awesomium::WebView::injectKeyboardEvent(HWND hwnd, UINT message, WPARAM wparam, LPARAM lparam)
 {
-	coreThread->message_loop()->PostTask(FROM_HERE, NewRunnableMethod(viewProxy, &WebViewProxy::injectKeyboardEvent, hwnd, message, wparam, lparam));
+	QueuedInputEvent event(QueuedInputEvent::KEYBOARD);
+	event.hwnd = hwnd;
+	event.message = message;
+	event.wparam = wparam;
+	event.lparam = lparam;
+
+	if(viewProxy->queueInput(event))
+		postInputFlush();
 }
 
 #elif defined(__APPLE__)
 void Awesomium::WebView::injectKeyboardEvent(NSEvent* keyboardEvent)
 {
-	coreThread->message_loop()->PostTask(FROM_HERE, NewRunnableMethod(viewProxy, &WebViewProxy::injectKeyboardEvent, keyboardEvent));
+	QueuedInputEvent event(QueuedInputEvent::KEYBOARD);
+	event.keyboardEvent = keyboardEvent;
+
+	if(viewProxy->queueInput(event))
+		postInputFlush();
 }
 
 #endif
 
 void Awesomium::WebView::cut()
 {
-	coreThread->message_loop()->PostTask(FROM_HERE, NewRunnableMethod(viewProxy, &WebViewProxy::cut));
+	postCommand(WebViewCommand::CUT);
 }
 
 void Awesomium::WebView::copy()
 {
-	coreThread->message_loop()->PostTask(FROM_HERE, NewRunnableMethod(viewProxy, &WebViewProxy::copy));
+	postCommand(WebViewCommand::COPY);
 }
 
 void Awesomium::WebView::paste()
 {
-	coreThread->message_loop()->PostTask(FROM_HERE, NewRunnableMethod(viewProxy, &WebViewProxy::paste));
+	postCommand(WebViewCommand::PASTE);
 }
 
 void Awesomium::WebView::selectAll()
 {
-	coreThread->message_loop()->PostTask(FROM_HERE, NewRunnableMethod(viewProxy, &WebViewProxy::selectAll));
+	postCommand(WebViewCommand::SELECT_ALL);
 }
 
 void Awesomium::WebView::deselectAll()
 {
-	coreThread->message_loop()->PostTask(FROM_HERE, NewRunnableMethod(viewProxy, &WebViewProxy::deselectAll));
+	postCommand(WebViewCommand::DESELECT_ALL);
 }
 
 void Awesomium::WebView::getContentAsText(std::wstring& result, int maxChars)
 {
-	coreThread->message_loop()->PostTask(FROM_HERE, NewRunnableMethod(viewProxy, &WebViewProxy::getContentAsText, &result, maxChars));
+	WebViewCommand& command = beginCommand(WebViewCommand::GET_CONTENT_AS_TEXT);
+	command.pointerArg[0] = &result;
+	command.intArg[0] = maxChars;
+	endCommand(true);
 	waitState->getContentTextEvent.Wait();
 }
 
+void Awesomium::WebView::requestContentAsText(Awesomium::ContentTextHandler* handler, int maxChars, Awesomium::TextEncoding encoding, int chunkSize)
+{
+	WebViewCommand& command = beginCommand(WebViewCommand::REQUEST_CONTENT_AS_TEXT);
+	command.pointerArg[0] = handler;
+	command.intArg[0] = maxChars;
+	command.intArg[1] = encoding;
+	command.intArg[2] = chunkSize;
+	endCommand();
+}
+
 void Awesomium::WebView::zoomIn()
 {
-	coreThread->message_loop()->PostTask(FROM_HERE, NewRunnableMethod(viewProxy, &WebViewProxy::zoomIn));
+	postCommand(WebViewCommand::ZOOM_IN);
 }
 
 void Awesomium::WebView::zoomOut()
 {
-	coreThread->message_loop()->PostTask(FROM_HERE, NewRunnableMethod(viewProxy, &WebViewProxy::zoomOut));
+	postCommand(WebViewCommand::ZOOM_OUT);
 }
 
 void Awesomium::WebView::resetZoom()
 {
-	coreThread->message_loop()->PostTask(FROM_HERE, NewRunnableMethod(viewProxy, &WebViewProxy::resetZoom));
+	postCommand(WebViewCommand::RESET_ZOOM);
 }
 
 void Awesomium::WebView::resize(int width, int height)
 {
-	coreThread->message_loop()->PostTask(FROM_HERE, NewRunnableMethod(viewProxy, &WebViewProxy::resize, width, height));
+	WebViewCommand& command = beginCommand(WebViewCommand::RESIZE);
+	command.intArg[0] = width;
+	command.intArg[1] = height;
+	endCommand(true);
 	waitState->resizeEvent.Wait();
 }
 
 void Awesomium::WebView::focus()
 {
-	executeJavascript("window.focus()");
+	WebViewCommand& command = beginCommand(WebViewCommand::SET_FOCUS);
+	command.intArg[0] = true;
+	endCommand();
 }
 
 void Awesomium::WebView::unfocus()
 {
-	executeJavascript("window.blur()");
+	WebViewCommand& command = beginCommand(WebViewCommand::SET_FOCUS);
+	command.intArg[0] = false;
+	endCommand();
 }
 
 void Awesomium::WebView::setTransparent(bool isTransparent)
 {
-	coreThread->message_loop()->PostTask(FROM_HERE, NewRunnableMethod(viewProxy, &WebViewProxy::setTransparent, isTransparent));
+	WebViewCommand& command = beginCommand(WebViewCommand::SET_TRANSPARENT);
+	command.intArg[0] = isTransparent;
+	endCommand();
+}
+
+void Awesomium::WebView::setPriority(Awesomium::WebViewPriority priority)
+{
+	WebViewCommand& command = beginCommand(WebViewCommand::SET_PRIORITY);
+	command.intArg[0] = priority;
+	endCommand();
+}
+
+void Awesomium::WebView::setCommandQueueLimit(int maxDepth, Awesomium::CommandQueuePolicy policy)
+{
+	viewProxy->commandQueue->setLimit(maxDepth > 0 ? maxDepth : 1, policy);
+}
+
+Awesomium::WebViewStats Awesomium::WebView::getStats()
+{
+	WebViewStats stats;
+
+	viewProxy->getInputStats(stats.numInputEventsInjected, stats.numInputEventsCoalesced);
+	viewProxy->getSchedulingStats(stats.numScheduledSlices, stats.averageQueueDelayMicroseconds, stats.maxQueueDelayMicroseconds);
+	viewProxy->commandQueue->getStats(stats.numCommandsDropped, stats.commandQueueHighWater);
+
+	return stats;
+}
+
+void Awesomium::WebView::postInputFlush()
+{
+	// All input that is queued before this task runs will be drained in a single pass
+	postCommand(WebViewCommand::FLUSH_INPUT);
+}
+
+WebViewCommand& Awesomium::WebView::beginCommand(int type, const std::string& target)
+{
+	return viewProxy->commandQueue->beginPush((WebViewCommand::Type)type, target);
+}
+
+void Awesomium::WebView::endCommand(bool isBlocking)
+{
+	// Commands are held back while a batch is open, unless we are about to wait on the result
+	viewProxy->commandQueue->endPush(isBlocking || !batchDepth);
+
+	// In single-threaded mode nobody else will run it, so the caller's wait would never end
+	if(isBlocking && isCoreInline)
+		viewProxy->drainCommands();
+}
+
+void Awesomium::WebView::postCommand(int type, bool isBlocking)
+{
+	beginCommand(type);
+	endCommand(isBlocking);
+}
+
+void Awesomium::WebView::submitBatch()
+{
+	viewProxy->commandQueue->publish();
 }
 
 void Awesomium::WebView::setDirty(bool val)
@@ -376,98 +700,242 @@ void Awesomium::WebView::setFinishResize()
 	waitState->resizeEvent.Signal();
 }
 
-void Awesomium::WebView::resolveJSValueFuture(int requestID, Awesomium::JSValue* result)
+/**
+* Registers 'count' pending futures with consecutive request IDs, returns the first ID.
+*
+* @note	IDs wrap around after 2^32 requests, always do arithmetic on them unsigned.
+*/
+int Awesomium::WebView::createJSValueFutures(int count)
 {
-	std::map<int, JSValueFutureImpl*>::iterator i;
+	// Shared by all WebViews, which may be driven from different threads
+	static base::subtle::Atomic32 requestIDCounter = 0;
+	unsigned int firstRequestID;
 
-	jsValueFutureMapLock->Lock();
+	// 0 means "no request" to FutureJSValue, skip the range that contains it when the counter wraps around
+	do
+	{
+		firstRequestID = (unsigned int)base::subtle::NoBarrier_AtomicIncrement(&requestIDCounter, count) - count + 1;
+	}
+	while(0u - firstRequestID < (unsigned int)count);
+
+	for(int n = 0; n < count; n++)
+	{
+		int requestID = (int)(firstRequestID + n);
+		int shard = getFutureShard(requestID);
+
+		JSValueFutureImpl* futureImpl = new JSValueFutureImpl();
+		futureImpl->AddRef();
 
-	i = jsValueFutureMap.find(requestID);
+		jsValueFutureLocks[shard]->Lock();
+		jsValueFutureMaps[shard][requestID] = futureImpl;
+		jsValueFutureLocks[shard]->Unlock();
+	}
 
-	if(i != jsValueFutureMap.end())
+	return (int)firstRequestID;
+}
+
+int Awesomium::WebView::getFutureShard(int requestID) const
+{
+	return (int)((unsigned int)requestID % kNumFutureShards);
+}
+
+bool Awesomium::WebView::isJSValueFutureResolved(int requestID)
+{
+	int shard = getFutureShard(requestID);
+	jsValueFutureLocks[shard]->Lock();
+
+	std::map<int, JSValueFutureImpl*>::iterator i = jsValueFutureMaps[shard].find(requestID);
+
+	// A request that is no longer in the map has been given up on, resolving it won't block either
+	bool isResolved = i == jsValueFutureMaps[shard].end() || (*i).second->value;
+
+	jsValueFutureLocks[shard]->Unlock();
+
+	return isResolved;
+}
+
+bool Awesomium::WebView::resolveJSValueFuture(int requestID, Awesomium::JSValue* result, Awesomium::JSError* error, int timeoutMilliseconds)
+{
+	int shard = getFutureShard(requestID);
+	LockImpl* lock = jsValueFutureLocks[shard];
+	std::map<int, JSValueFutureImpl*>& futureMap = jsValueFutureMaps[shard];
+
+	// The Javascript for this request may still be sitting in an open batch
+	submitBatch();
+
+	lock->Lock();
+
+	std::map<int, JSValueFutureImpl*>::iterator i = futureMap.find(requestID);
+
+	if(i == futureMap.end())
 	{
-		JSValueFutureImpl* futureImpl = (*i).second;
+		lock->Unlock();
+		*result = Awesomium::JSValue();
+		*error = Awesomium::JSError();
+		return true;
+	}
 
-		if(!futureImpl->value)
-		{
-			jsValueFutureMapLock->Unlock();
+	// Copies of the FutureJSValue share the request, hold on to it in case one of them takes it while we wait
+	scoped_refptr<JSValueFutureImpl> futureImpl = (*i).second;
+
+	if(!futureImpl->value && timeoutMilliseconds != 0)
+	{
+		lock->Unlock();
+
+		if(isCoreInline)
+			pumpUntilResolved(futureImpl, lock, timeoutMilliseconds);
+		else if(timeoutMilliseconds < 0)
 			futureImpl->resolveFutureEvent.Wait();
-			jsValueFutureMapLock->Lock();
-		}
+		else
+			futureImpl->resolveFutureEvent.TimedWait(base::TimeDelta::FromMilliseconds(timeoutMilliseconds));
 
-		if(!futureImpl->value)
-		{
-			// Try again with a timed wait
-			jsValueFutureMapLock->Unlock();
-			futureImpl->resolveFutureEvent.TimedWait(base::TimeDelta::FromMilliseconds(300));
-			jsValueFutureMapLock->Lock();
-
-			if(!futureImpl->value)
-			{
-				*result = Awesomium::JSValue();
-				delete futureImpl;
-				jsValueFutureMap.erase(i);
-				jsValueFutureMapLock->Unlock();
-				return;
-			}
-		}
+		lock->Lock();
+	}
 
-		*result = *futureImpl->value;
-		delete futureImpl;
-		jsValueFutureMap.erase(i);
+	if(!futureImpl->value)
+	{
+		// Still pending, the caller may try again later
+		lock->Unlock();
+		return false;
 	}
-	else
+
+	// Copy rather than swap, other waiters may be about to read it too
+	*result = *futureImpl->value;
+	*error = futureImpl->error;
+
+	// The map may have changed while we waited, look the request up again
+	i = futureMap.find(requestID);
+	if(i != futureMap.end() && (*i).second == futureImpl.get())
 	{
-		*result = Awesomium::JSValue();
+		futureMap.erase(i);
+		futureImpl->Release();
 	}
 
-	jsValueFutureMapLock->Unlock();
+	lock->Unlock();
+
+	return true;
 }
 
-void Awesomium::WebView::handleFutureJSValueCallback(const Awesomium::JSArguments& args)
+void Awesomium::WebView::setJSValueFutureHandler(int requestID, Awesomium::FutureJSValueHandler* handler)
 {
-	if(args.size() != 2)
-		return;
+	int shard = getFutureShard(requestID);
 
-	int requestID = args[0].toInteger();
+	// The Javascript for this request may still be sitting in an open batch
+	submitBatch();
 
-	std::map<int, JSValueFutureImpl*>::iterator i;
+	jsValueFutureLocks[shard]->Lock();
+
+	std::map<int, JSValueFutureImpl*>::iterator i = jsValueFutureMaps[shard].find(requestID);
+
+	if(i == jsValueFutureMaps[shard].end())
+	{
+		WebCore::Get().queueEvent(new WebViewEvents::ResolveFuture(0, handler, Awesomium::JSValue(), Awesomium::JSError()));
+	}
+	else if((*i).second->value)
+	{
+		WebCore::Get().queueEvent(new WebViewEvents::ResolveFuture(0, handler, *(*i).second->value, (*i).second->error));
+		(*i).second->Release();
+		jsValueFutureMaps[shard].erase(i);
+	}
+	else
+	{
+		// setFutureJSValue will pass it on
+		(*i).second->handler = handler;
+	}
 
-	jsValueFutureMapLock->Lock();
+	jsValueFutureLocks[shard]->Unlock();
+}
 
-	i = jsValueFutureMap.find(requestID);
+/**
+* In single-threaded mode there is no core thread to resolve the future while we wait, so we run
+* the queued commands (and then the message loop) ourselves until it has been resolved. Between
+* runs we block for a moment rather than spin, replies from the IO thread arrive as posted tasks.
+*/
+void Awesomium::WebView::pumpUntilResolved(JSValueFutureImpl* futureImpl, LockImpl* lock, int timeoutMilliseconds)
+{
+	const int kPumpIntervalMilliseconds = 1;
+	base::TimeTicks startTime = base::TimeTicks::Now();
 
-	if(i == jsValueFutureMap.end())
-		return;
+	viewProxy->drainCommands();
 
-	JSValueFutureImpl* futureImpl = (*i).second;
+	bool wasNestableAllowed = coreLoop->NestableTasksAllowed();
+	coreLoop->SetNestableTasksAllowed(true);
 
-	if(!futureImpl->value)
+	while(true)
 	{
-		futureImpl->value = new Awesomium::JSValue();
-		*futureImpl->value = args[1];
+		lock->Lock();
+		bool isResolved = futureImpl->value != 0;
+		lock->Unlock();
+
+		if(isResolved)
+			break;
+
+		int waitMilliseconds = kPumpIntervalMilliseconds;
+
+		if(timeoutMilliseconds >= 0)
+		{
+			int remaining = timeoutMilliseconds - (int)(base::TimeTicks::Now() - startTime).InMilliseconds();
+			if(remaining <= 0)
+				break;
+
+			waitMilliseconds = std::min(waitMilliseconds, remaining);
+		}
+
+		coreLoop->RunAllPending();
+
+		// Returns right away if that resolved it
+		futureImpl->resolveFutureEvent.TimedWait(base::TimeDelta::FromMilliseconds(waitMilliseconds));
 	}
 
-	jsValueFutureMapLock->Unlock();
+	coreLoop->SetNestableTasksAllowed(wasNestableAllowed);
+}
+
+void Awesomium::WebView::setFutureJSValue(int requestID, const Awesomium::JSValue& value)
+{
+	resolveFuture(requestID, value, Awesomium::JSError());
+}
 
-	if(!futureImpl->resolveFutureEvent.IsSignaled())
-		futureImpl->resolveFutureEvent.Signal();
+void Awesomium::WebView::setFutureJSError(int requestID, const Awesomium::JSError& error)
+{
+	resolveFuture(requestID, Awesomium::JSValue(), error);
 }
 
-void Awesomium::WebView::nullifyFutureJSValueCallbacks()
+void Awesomium::WebView::resolveFuture(int requestID, const Awesomium::JSValue& value, const Awesomium::JSError& error)
 {
-	jsValueFutureMapLock->Lock();
+	int shard = getFutureShard(requestID);
+	jsValueFutureLocks[shard]->Lock();
+
+	std::map<int, JSValueFutureImpl*>::iterator i = jsValueFutureMaps[shard].find(requestID);
 
-	for(std::map<int, JSValueFutureImpl*>::iterator i = jsValueFutureMap.begin(); i != jsValueFutureMap.end(); i++)
+	// The caller may have given up on it already
+	if(i == jsValueFutureMaps[shard].end())
 	{
-		if(!i->second->value)
-		{
-			i->second->value = new Awesomium::JSValue();
-			i->second->resolveFutureEvent.Signal();
-		}
+		jsValueFutureLocks[shard]->Unlock();
+		return;
+	}
+
+	JSValueFutureImpl* futureImpl = (*i).second;
+
+	if(!futureImpl->value)
+	{
+		futureImpl->value = new Awesomium::JSValue(value);
+		futureImpl->error = error;
+	}
+
+	// Signal while we still hold the lock, so that the value and the event are published together. A copy of
+	// the FutureJSValue may still be waiting on it even if another copy has handed it to a handler.
+	futureImpl->resolveFutureEvent.Signal();
+
+	if(futureImpl->handler)
+	{
+		// Its handler is called from WebCore::update. The event isn't tied to this WebView, so that
+		// the handler is still called if the WebView is destroyed in the meantime.
+		WebCore::Get().queueEvent(new WebViewEvents::ResolveFuture(0, futureImpl->handler, value, error));
+		jsValueFutureMaps[shard].erase(i);
+		futureImpl->Release();
 	}
 
-	jsValueFutureMapLock->Unlock();
+	jsValueFutureLocks[shard]->Unlock();
 }
 
 void Awesomium::WebView::handleCheckKeyboardFocus(bool isFocused)
@@ -0,0 +1,338 @@
+/*
+	This file is a part of Awesomium, a library that makes it easy for 
+	developers to embed web-content in their applications.
+
+	Copyright (C) 2009 Adam J. Simmons
+
+	Project Website:
+	<http://princeofcode.com/awesomium.php>
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 
+	02110-1301 USA
+*/
+
+
+#include "WebViewCommand.h"
+#include "WebViewProxy.h"
+#include "WebCoreProxy.h"
+#include "base/lock.h"
+#include "base/message_loop.h"
+#include <assert.h>
+
+WebViewCommand::WebViewCommand() : type(REFRESH)
+{
+	intArg[0] = intArg[1] = intArg[2] = 0;
+	pointerArg[0] = pointerArg[1] = 0;
+}
+
+bool WebViewCommand::isEssential(Type type)
+{
+	switch(type)
+	{
+	case STARTUP:
+	case SHUTDOWN:
+	case EXECUTE_JAVASCRIPT_WITH_RESULT:
+	case EVALUATE_BATCH:
+	case COMPILE_FUNCTION:
+	case INVOKE_FUNCTION:
+	case RELEASE_FUNCTION:
+	case RENDER_SYNC:
+	case FLUSH_INPUT:
+	case GET_CONTENT_AS_TEXT:
+	case REQUEST_CONTENT_AS_TEXT:
+	case RESIZE:
+		return true;
+	default:
+		return false;
+	}
+}
+
+bool WebViewCommand::isCoalescible(Type type)
+{
+	switch(type)
+	{
+	case SET_PROPERTY:
+	case SET_CALLBACK_POLICY:
+	case SET_CALLBACK_RECEIVES_BUFFERS:
+	case SET_TRANSPARENT:
+	case SET_FOCUS:
+	case SET_PRIORITY:
+		return true;
+	default:
+		return false;
+	}
+}
+
+bool WebViewCommand::hasTarget(Type type)
+{
+	switch(type)
+	{
+	case SET_PROPERTY:
+	case SET_CALLBACK_POLICY:
+	case SET_CALLBACK_RECEIVES_BUFFERS:
+		return true;
+	default:
+		return false;
+	}
+}
+
+void WebViewCommand::moveTo(WebViewCommand& other)
+{
+	other.type = type;
+
+	for(int i = 0; i < 3; i++)
+	{
+		other.intArg[i] = intArg[i];
+		other.stringArg[i].swap(stringArg[i]);
+	}
+
+	other.pointerArg[0] = pointerArg[0];
+	other.pointerArg[1] = pointerArg[1];
+	other.frameName.swap(frameName);
+	other.stringList.swap(stringList);
+	other.value.swap(value);
+}
+
+WebViewCommandQueue::WebViewCommandQueue(WebViewProxy* consumer, MessageLoop* consumerLoop, WebCoreProxy* scheduler, size_t capacity)
+: consumer(consumer), consumerLoop(consumerLoop), scheduler(scheduler), slots(capacity), head(0), numPublished(0), numUnpublished(0),
+	maxDepth(capacity), highWater(0), policy(Awesomium::QUEUE_POLICY_BLOCK), numDropped(0), isDrainPending(false), pushMode(PUSH_APPEND),
+	spaceAvailableEvent(false, false)
+{
+	assert(capacity > 0);
+
+	lock = new LockImpl();
+}
+
+WebViewCommandQueue::~WebViewCommandQueue()
+{
+	delete lock;
+}
+
+WebViewCommand& WebViewCommandQueue::beginPush(WebViewCommand::Type type, const std::string& target)
+{
+	lock->Lock();
+
+	while(numPublished + numUnpublished >= maxDepth)
+	{
+		if(policy != Awesomium::QUEUE_POLICY_BLOCK && !WebViewCommand::isEssential(type))
+		{
+			if(policy == Awesomium::QUEUE_POLICY_FAIL)
+			{
+				numDropped++;
+				pushMode = PUSH_DISCARD;
+				discardSlot.type = type;
+
+				// The lock is held until endPush
+				return discardSlot;
+			}
+			else if(policy == Awesomium::QUEUE_POLICY_DROP_OLDEST && dropOldestLocked())
+			{
+				numDropped++;
+				break;
+			}
+			else if(policy == Awesomium::QUEUE_POLICY_COALESCE)
+			{
+				WebViewCommand* superseded = findSupersededLocked(type, target);
+
+				if(superseded)
+				{
+					numDropped++;
+					pushMode = PUSH_REPLACE;
+
+					// The lock is held until endPush
+					return *superseded;
+				}
+			}
+		}
+
+		// Commands that are still being held back can never be consumed, publish them so that we don't deadlock.
+		bool needsDrain = publishLocked();
+		lock->Unlock();
+
+		if(needsDrain)
+			scheduleDrain();
+
+		// If the consumer runs on this thread (WebCore's single-threaded mode), make room ourselves
+		if(MessageLoop::current() == consumerLoop)
+			consumer->drainCommands();
+		else
+			spaceAvailableEvent.Wait();
+
+		lock->Lock();
+	}
+
+	pushMode = PUSH_APPEND;
+
+	if(numPublished + numUnpublished + 1 > highWater)
+		highWater = numPublished + numUnpublished + 1;
+
+	WebViewCommand& slot = slots[(head + numPublished + numUnpublished) % slots.size()];
+	slot.type = type;
+
+	// The lock is held until endPush
+	return slot;
+}
+
+void WebViewCommandQueue::endPush(bool shouldPublish)
+{
+	if(pushMode == PUSH_APPEND)
+		numUnpublished++;
+
+	bool needsDrain = shouldPublish ? publishLocked() : false;
+
+	lock->Unlock();
+
+	if(needsDrain)
+		scheduleDrain();
+}
+
+void WebViewCommandQueue::publish()
+{
+	lock->Lock();
+	bool needsDrain = publishLocked();
+	lock->Unlock();
+
+	if(needsDrain)
+		scheduleDrain();
+}
+
+bool WebViewCommandQueue::publishLocked()
+{
+	if(!numUnpublished)
+		return false;
+
+	numPublished += numUnpublished;
+	numUnpublished = 0;
+
+	if(isDrainPending)
+		return false;
+
+	isDrainPending = true;
+	return true;
+}
+
+void WebViewCommandQueue::scheduleDrain()
+{
+	// This happens at most once per drain rather than once per command.
+	scheduler->scheduleView(consumer);
+}
+
+/**
+* Discards the oldest command that isn't essential, shifting the ones before it up by one slot.
+*/
+bool WebViewCommandQueue::dropOldestLocked()
+{
+	size_t count = numPublished + numUnpublished;
+	size_t index = 0;
+
+	while(index < count && WebViewCommand::isEssential(slots[(head + index) % slots.size()].type))
+		index++;
+
+	if(index == count)
+		return false;
+
+	for(size_t i = index; i > 0; i--)
+		slots[(head + i - 1) % slots.size()].moveTo(slots[(head + i) % slots.size()]);
+
+	head = (head + 1) % slots.size();
+
+	if(index < numPublished)
+		numPublished--;
+	else
+		numUnpublished--;
+
+	return true;
+}
+
+/**
+* Returns the newest queued command if the new one would supersede it (same state, same target), so that
+* it can be overwritten in place. Older commands are never considered: replacing one of those would run
+* the new command ahead of the ones that were queued after it.
+*/
+WebViewCommand* WebViewCommandQueue::findSupersededLocked(WebViewCommand::Type type, const std::string& target)
+{
+	size_t count = numPublished + numUnpublished;
+
+	if(!count || !WebViewCommand::isCoalescible(type))
+		return 0;
+
+	WebViewCommand& newest = slots[(head + count - 1) % slots.size()];
+
+	if(newest.type != type || (WebViewCommand::hasTarget(type) && newest.stringArg[0] != target))
+		return 0;
+
+	return &newest;
+}
+
+bool WebViewCommandQueue::pop(WebViewCommand& result)
+{
+	lock->Lock();
+
+	if(!numPublished)
+	{
+		isDrainPending = false;
+		lock->Unlock();
+		return false;
+	}
+
+	bool wasFull = numPublished + numUnpublished >= maxDepth;
+
+	slots[head].moveTo(result);
+	head = (head + 1) % slots.size();
+	numPublished--;
+
+	lock->Unlock();
+
+	if(wasFull)
+		spaceAvailableEvent.Signal();
+
+	return true;
+}
+
+void WebViewCommandQueue::setLimit(size_t maxDepth, Awesomium::CommandQueuePolicy policy)
+{
+	lock->Lock();
+
+	if(maxDepth > slots.size())
+	{
+		// Grow the ring, keeping the queued commands in order
+		std::vector<WebViewCommand> newSlots(maxDepth);
+		size_t count = numPublished + numUnpublished;
+
+		for(size_t i = 0; i < count; i++)
+			slots[(head + i) % slots.size()].moveTo(newSlots[i]);
+
+		slots.swap(newSlots);
+		head = 0;
+	}
+
+	bool wasFull = numPublished + numUnpublished >= this->maxDepth;
+
+	this->maxDepth = maxDepth;
+	this->policy = policy;
+
+	lock->Unlock();
+
+	if(wasFull)
+		spaceAvailableEvent.Signal();
+}
+
+void WebViewCommandQueue::getStats(int& numDropped, int& highWater)
+{
+	lock->Lock();
+	numDropped = this->numDropped;
+	highWater = (int)this->highWater;
+	lock->Unlock();
+}
@@ -25,6 +25,7 @@
 
 #include "WebViewEvent.h"
 #include "WebViewProxy.h"
+#include "base/string_util.h"
 
 WebViewEvent::WebViewEvent(Awesomium::WebView* view) : view(view)
 {
@@ -51,6 +52,8 @@ FinishLoad::FinishLoad(Awesomium::WebView* view) : WebViewEvent(view)
 
 void FinishLoad::run()
 {
+	view->numFinishedLoads++;
+
 	Awesomium::WebViewListener* listener = view->getListener();
 
 	if(listener)
@@ -81,19 +84,99 @@ void ReceiveTitle::run()
 		listener->onReceiveTitle(title, frameName);
 }
 
-InvokeCallback::InvokeCallback(Awesomium::WebView* view, const std::string& name, const Awesomium::JSArguments& args) : WebViewEvent(view),
-	name(name), args(args)
+bool PendingCallback::add(Awesomium::JSArguments& invocationArgs, bool shouldAccumulate)
+{
+	AutoLock autoLock(lock);
+
+	if(shouldAccumulate)
+	{
+		args.push_back(Awesomium::JSValue());
+		args.back().getArray().swap(invocationArgs);
+	}
+	else
+	{
+		args.swap(invocationArgs);
+	}
+
+	bool wasQueued = isQueued;
+	isQueued = true;
+
+	return !wasQueued;
+}
+
+void PendingCallback::take(Awesomium::JSArguments& result)
+{
+	AutoLock autoLock(lock);
+
+	result.clear();
+	result.swap(args);
+	isQueued = false;
+}
+
+InvokeCallback::InvokeCallback(Awesomium::WebView* view, const std::string& name, Awesomium::JSArguments& args,
+	Awesomium::CallbackHandler* handler) : WebViewEvent(view), name(name), handler(handler)
+{
+	this->args.swap(args);
+}
+
+InvokeCallback::InvokeCallback(Awesomium::WebView* view, const std::string& name, PendingCallback* pending,
+	Awesomium::CallbackHandler* handler) : WebViewEvent(view), name(name), handler(handler), pending(pending)
 {
 }
 
 void InvokeCallback::run()
 {
+	if(pending)
+		pending->take(args);
+
+	if(handler)
+	{
+		handler->handleCallback(view, name, args);
+		return;
+	}
+
 	Awesomium::WebViewListener* listener = view->getListener();
 
 	if(listener)
 		listener->onCallback(name, args);
 }
 
+bool PendingConsoleMessages::add(const Awesomium::ConsoleMessage& message)
+{
+	AutoLock autoLock(lock);
+
+	messages.push_back(message);
+
+	bool wasQueued = isQueued;
+	isQueued = true;
+
+	return !wasQueued;
+}
+
+void PendingConsoleMessages::take(std::vector<Awesomium::ConsoleMessage>& result)
+{
+	AutoLock autoLock(lock);
+
+	result.clear();
+	result.swap(messages);
+	isQueued = false;
+}
+
+ReceiveConsoleMessages::ReceiveConsoleMessages(Awesomium::WebView* view, PendingConsoleMessages* pending) : WebViewEvent(view), pending(pending)
+{
+}
+
+void ReceiveConsoleMessages::run()
+{
+	std::vector<Awesomium::ConsoleMessage> messages;
+	pending->take(messages);
+
+	Awesomium::ConsoleMessageHandler* handler = view->getConsoleMessageHandler();
+
+	if(handler && messages.size())
+		handler->onConsoleMessages(view, messages);
+}
+
 ChangeTooltip::ChangeTooltip(Awesomium::WebView* view, const std::wstring& tooltip) : WebViewEvent(view), tooltip(tooltip)
 {
 }
@@ -146,3 +229,52 @@ void ChangeTargetURL::run()
 		listener->onChangeTargetURL(url);
 }
 
+
+ResolveFuture::ResolveFuture(Awesomium::WebView* view, Awesomium::FutureJSValueHandler* handler, const Awesomium::JSValue& value,
+	const Awesomium::JSError& error) : WebViewEvent(view), handler(handler), value(value), error(error)
+{
+}
+
+void ResolveFuture::run()
+{
+	if(error.isError())
+		handler->onError(error);
+	else
+		handler->onResolve(value);
+}
+
+ReceiveContentText::ReceiveContentText(Awesomium::WebView* view, Awesomium::ContentTextHandler* handler, Awesomium::TextEncoding encoding, 
+	const string16& text, int totalLength) : WebViewEvent(view), handler(handler), encoding(encoding), totalLength(totalLength)
+{
+	// This is constructed on the core thread, so the conversion happens there instead of in WebCore::update
+	if(encoding == Awesomium::TEXT_ENCODING_UTF8)
+		utf8Text = UTF16ToUTF8(text);
+	else if(encoding == Awesomium::TEXT_ENCODING_UTF16)
+		utf16Text = text;
+	else
+		wideText = UTF16ToWide(text);
+}
+
+void ReceiveContentText::run()
+{
+	if(!handler)
+		return;
+
+	if(encoding == Awesomium::TEXT_ENCODING_UTF8)
+	{
+		if(utf8Text.length())
+			handler->onContentTextUTF8(utf8Text);
+	}
+	else if(encoding == Awesomium::TEXT_ENCODING_UTF16)
+	{
+		if(utf16Text.length())
+			handler->onContentTextUTF16(reinterpret_cast<const unsigned short*>(utf16Text.data()), (int)utf16Text.length());
+	}
+	else if(wideText.length())
+	{
+		handler->onContentText(wideText);
+	}
+
+	if(totalLength >= 0)
+		handler->onFinishContentText(totalLength);
+}
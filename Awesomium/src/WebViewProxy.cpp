@@ -31,6 +31,7 @@
 #include "WebSize.h"
 #include "WebScreenInfo.h"
 #include "NavigationController.h"
+#include "base/thread.h"
 #include "base/path_service.h"
 #include "base/string_util.h"
 #include "webkit/glue/plugins/plugin_list.h"
@@ -38,9 +39,12 @@
 #include "WebPopupMenuInfo.h"
 #include "WebDataSource.h"
 #include "WebURLResponse.h"
+#include "WebScriptSource.h"
+#include "WebBindings.h"
 #include "net/base/base64.h"
 #include "skia/ext/platform_canvas.h"
 #include <assert.h>
+#include <algorithm>
 
 #include "webkit/glue/media/buffered_data_source.h"
 #include "webkit/appcache/appcache_interfaces.h"
@@ -77,18 +81,24 @@ static std::wstring WebStringToWString(const WebKit::WebString &str) {
 }
 
 WebViewProxy::WebViewProxy(int width, int height, bool isTransparent, bool enableAsyncRendering, int maxAsyncRenderPerSec, Awesomium::WebView* parent)
-: refCount(0), width(width), height(height), canvas(0),
+: refCount(0), width(width), height(height), frameBuffer(0), isFrameReady(false), canvas(0),
 mouseX(0), mouseY(0), view(0), parent(parent),
 isPopupsDirty(false), needsPainting(false),
-clientObject(0), enableAsyncRendering(enableAsyncRendering), isAsyncRenderDirty(false),
+clientObject(0), capturedError(0), pendingConsoleMessages(new WebViewEvents::PendingConsoleMessages()),
+isInputFlushPending(false), numInputInjected(0), numInputCoalesced(0),
+enableAsyncRendering(enableAsyncRendering), isAsyncRenderDirty(false),
 maxAsyncRenderPerSec(maxAsyncRenderPerSec), isTransparent(isTransparent),
-pageID(-1), nextPageID(1)
+pageID(-1), nextPageID(1),
+isScheduled(false), virtualTime(0), weight(4), numSlices(0), maxQueueDelay(0), totalQueueDelay(0)
 {
 	renderBuffer = new Awesomium::RenderBuffer(width, height);
 	canvas = new skia::PlatformCanvas(width, height, true);
 	renderBufferLock = new LockImpl();
 	refCountLock = new LockImpl();
+	inputQueueLock = new LockImpl();
+	schedulingStatsLock = new LockImpl();
 	navController = new NavigationController(this);
+	commandQueue = new WebViewCommandQueue(this, parent->coreLoop, Awesomium::WebCore::Get().coreProxy, 256);
 
 	if(enableAsyncRendering)
 		backBuffer = new Awesomium::RenderBuffer(width, height);
@@ -104,7 +114,13 @@ WebViewProxy::~WebViewProxy()
 	if(backBuffer)
 		delete backBuffer;
 
+	if(frameBuffer)
+		delete frameBuffer;
+
 	delete navController;
+	delete commandQueue;
+	delete inputQueueLock;
+	delete schedulingStatsLock;
 	delete refCountLock;
 	delete renderBufferLock;
 	delete canvas;
@@ -127,7 +143,7 @@ void WebViewProxy::asyncStartup()
 		if(maxAsyncRenderPerSec <= 0 || maxAsyncRenderPerSec > 300)
 			maxAsyncRenderPerSec = 70;
 
-		renderTimer.Start(base::TimeDelta::FromMilliseconds(1000 / maxAsyncRenderPerSec), this, &WebViewProxy::renderAsync);
+		// The render timer is armed by scheduleAsyncRender once there is something to render
 	}
 
 	LOG(INFO) << "A new WebViewProxy has been created.";
@@ -140,6 +156,14 @@ void WebViewProxy::asyncShutdown()
 
 	closeAllPopups();
 
+	releaseCompiledFunctions(0);
+
+	// The WebView is going away, streamed text can't be delivered anymore
+	for(size_t i = 0; i < pendingContentText.size(); i++)
+		delete pendingContentText[i];
+
+	pendingContentText.clear();
+
 	view->GetMainFrame()->collectGarbage();
 	view->GetMainFrame()->collectGarbage();
 
@@ -153,6 +177,193 @@ void WebViewProxy::asyncShutdown()
 	parent = 0;
 }	
 
+void WebViewProxy::drainCommands()
+{
+	Awesomium::WebCore::Get().coreProxy->countWakeup();
+
+	// Commands are moved out of the queue one at a time so that the host thread is free
+	// to keep pushing while we run them.
+	while(commandQueue->pop(currentCommand))
+		runCommand(currentCommand);
+}
+
+/**
+* Runs up to 'maxCommands' queued commands, called by the WebCoreProxy's scheduler.
+*
+* Returns true if commands remain (the queue is then still marked as pending and the scheduler
+* must pick us again), or false if the queue was drained.
+*/
+bool WebViewProxy::runSlice(int maxCommands, base::TimeDelta queueDelay)
+{
+	schedulingStatsLock->Lock();
+	numSlices++;
+	totalQueueDelay += queueDelay.InMicroseconds();
+	if(queueDelay.InMicroseconds() > maxQueueDelay)
+		maxQueueDelay = (int)queueDelay.InMicroseconds();
+	schedulingStatsLock->Unlock();
+
+	// Input goes ahead of everything else that is queued
+	if(hasPendingInput())
+		flushInput();
+
+	// A streamed getContentAsText yields one chunk per slice, counted against the same budget as commands
+	if(!pendingContentText.empty())
+	{
+		if(deliverContentText(pendingContentText.front()))
+			pendingContentText.pop_front();
+
+		maxCommands--;
+	}
+
+	for(int i = 0; i < maxCommands; i++)
+	{
+		if(!commandQueue->pop(currentCommand))
+			return !pendingContentText.empty();
+
+		runCommand(currentCommand);
+	}
+
+	return true;
+}
+
+bool WebViewProxy::hasPendingInput()
+{
+	inputQueueLock->Lock();
+	bool result = isInputFlushPending;
+	inputQueueLock->Unlock();
+
+	return result;
+}
+
+void WebViewProxy::setPriority(Awesomium::WebViewPriority priority)
+{
+	if(priority == Awesomium::VIEW_PRIORITY_FOREGROUND)
+		weight = kMaxWeight;
+	else if(priority == Awesomium::VIEW_PRIORITY_BACKGROUND)
+		weight = 1;
+	else
+		weight = 4;
+}
+
+void WebViewProxy::getSchedulingStats(int& numSlices, int& averageQueueDelay, int& maxQueueDelay)
+{
+	schedulingStatsLock->Lock();
+	numSlices = this->numSlices;
+	averageQueueDelay = this->numSlices ? (int)(totalQueueDelay / this->numSlices) : 0;
+	maxQueueDelay = this->maxQueueDelay;
+	schedulingStatsLock->Unlock();
+}
+
+void WebViewProxy::runCommand(WebViewCommand& command)
+{
+	switch(command.type)
+	{
+	case WebViewCommand::STARTUP:
+		asyncStartup();
+		break;
+	case WebViewCommand::SHUTDOWN:
+		asyncShutdown();
+		break;
+	case WebViewCommand::LOAD_URL:
+		loadURL(command.stringArg[0], command.frameName, command.stringArg[1], command.stringArg[2]);
+		break;
+	case WebViewCommand::LOAD_HTML:
+		loadHTML(command.stringArg[0], command.frameName);
+		break;
+	case WebViewCommand::LOAD_FILE:
+		loadFile(command.stringArg[0], command.frameName);
+		break;
+	case WebViewCommand::GO_TO_HISTORY_OFFSET:
+		goToHistoryOffset(command.intArg[0]);
+		break;
+	case WebViewCommand::REFRESH:
+		refresh();
+		break;
+	case WebViewCommand::EXECUTE_JAVASCRIPT:
+		executeJavascript(command.stringArg[0], command.frameName);
+		break;
+	case WebViewCommand::EXECUTE_JAVASCRIPT_WITH_RESULT:
+		executeJavascriptWithResult(command.stringArg[0], command.frameName, command.intArg[0]);
+		break;
+	case WebViewCommand::EVALUATE_BATCH:
+		evaluateBatch(command.stringList, command.frameName, command.intArg[0]);
+		break;
+	case WebViewCommand::COMPILE_FUNCTION:
+		compileFunction(command.stringArg[0], command.frameName, command.intArg[0]);
+		break;
+	case WebViewCommand::INVOKE_FUNCTION:
+		invokeFunction(command.intArg[0], command.value.getArray(), command.intArg[1]);
+		break;
+	case WebViewCommand::RELEASE_FUNCTION:
+		releaseFunction(command.intArg[0]);
+		break;
+	case WebViewCommand::SET_PROPERTY:
+		setProperty(command.stringArg[0], command.value);
+		break;
+	case WebViewCommand::SET_CALLBACK:
+		setCallback(command.stringArg[0], (Awesomium::CoreThreadCallback*)command.pointerArg[0], (Awesomium::CallbackHandler*)command.pointerArg[1]);
+		break;
+	case WebViewCommand::SET_CALLBACK_POLICY:
+		setCallbackPolicy(command.stringArg[0], (Awesomium::CallbackPolicy)command.intArg[0], command.intArg[1]);
+		break;
+	case WebViewCommand::SET_CALLBACK_RECEIVES_BUFFERS:
+		setCallbackReceivesBuffers(command.stringArg[0], command.intArg[0] != 0);
+		break;
+	case WebViewCommand::RENDER_SYNC:
+		renderSync((unsigned char*)command.pointerArg[0], command.intArg[0], command.intArg[1], (Awesomium::Rect*)command.pointerArg[1]);
+		break;
+	case WebViewCommand::REQUEST_RENDER:
+		renderRequested();
+		break;
+	case WebViewCommand::FLUSH_INPUT:
+		flushInput();
+		break;
+	case WebViewCommand::CUT:
+		cut();
+		break;
+	case WebViewCommand::COPY:
+		copy();
+		break;
+	case WebViewCommand::PASTE:
+		paste();
+		break;
+	case WebViewCommand::SELECT_ALL:
+		selectAll();
+		break;
+	case WebViewCommand::DESELECT_ALL:
+		deselectAll();
+		break;
+	case WebViewCommand::GET_CONTENT_AS_TEXT:
+		getContentAsText((std::wstring*)command.pointerArg[0], command.intArg[0]);
+		break;
+	case WebViewCommand::REQUEST_CONTENT_AS_TEXT:
+		requestContentAsText((Awesomium::ContentTextHandler*)command.pointerArg[0], command.intArg[0], 
+			(Awesomium::TextEncoding)command.intArg[1], command.intArg[2]);
+		break;
+	case WebViewCommand::ZOOM_IN:
+		zoomIn();
+		break;
+	case WebViewCommand::ZOOM_OUT:
+		zoomOut();
+		break;
+	case WebViewCommand::RESET_ZOOM:
+		resetZoom();
+		break;
+	case WebViewCommand::RESIZE:
+		resize(command.intArg[0], command.intArg[1]);
+		break;
+	case WebViewCommand::SET_TRANSPARENT:
+		setTransparent(!!command.intArg[0]);
+		break;
+	case WebViewCommand::SET_FOCUS:
+		setFocus(!!command.intArg[0]);
+		break;
+	case WebViewCommand::SET_PRIORITY:
+		setPriority((Awesomium::WebViewPriority)command.intArg[0]);
+		break;
+	}
+}
+
 void WebViewProxy::loadURL(const std::string& url, const std::wstring& frameName, const std::string& username, const std::string& password)
 {
 	std::wstring frame = WebStringToWString(view->GetMainFrame()->name());
@@ -200,8 +411,239 @@ void WebViewProxy::executeJavascript(const std::string& javascript, const std::w
 	if(!frame)
 		return;
 
-	WebKit::WebURLRequest request(GURL("javascript:" + javascript + ";void(0);"));
-	frame->loadRequest(request);
+	// Run it straight in the frame's script context, rather than navigating to a javascript: URL
+	frame->executeScript(WebKit::WebScriptSource(WebKit::WebString::fromUTF8(javascript)));
+}
+
+void WebViewProxy::executeJavascriptWithResult(const std::string& javascript, const std::wstring& frameName, int requestID)
+{
+	WebFrame* frame = view->GetMainFrame();
+
+	if(frameName.length())
+		frame = view->GetFrameWithName(frameName);
+
+	Awesomium::JSValue result;
+	Awesomium::JSError error;
+
+	// Evaluate directly in the frame's context and convert the result natively. If the frame is
+	// missing or the script throws, the future gets an error; either way it is resolved right away.
+	if(evaluate(frame, javascript, result, &error))
+		parent->setFutureJSValue(requestID, result);
+	else if(error.isError())
+		parent->setFutureJSError(requestID, error);
+	else
+		parent->setFutureJSError(requestID, Awesomium::JSError(frame ? "The Javascript could not be evaluated." : "The frame could not be found."));
+}
+
+void WebViewProxy::evaluateBatch(const std::vector<std::string>& expressions, const std::wstring& frameName, int firstRequestID)
+{
+	WebFrame* frame = view->GetMainFrame();
+
+	if(frameName.length())
+		frame = view->GetFrameWithName(frameName);
+
+	// Run every expression within one script, each one in its own try block so that a failure only affects
+	// its own result. The values and the errors come back as two arrays, indexed like the expressions; each
+	// error is [message, line, source]. V8 only reports where an exception was thrown in its stack trace, p()
+	// takes the source and line of the top frame from it. Frames in the batch script itself (whose source is
+	// found the same way, from an Error created on its first line) are reported without a source.
+	std::string script = "(function(){var v=[],e=[];function p(x){var m=x&&typeof x.stack=='string'&&"
+		"/\\n\\s*at (?:[^\\n(]*\\()?([^\\n]*?):(\\d+):\\d+/.exec(x.stack);return m?[m[1],+m[2]]:['',0];}"
+		"var o=p(new Error())[0];";
+	std::vector<int> firstLines(expressions.size());
+	int line = 1;
+
+	for(size_t i = 0; i < expressions.size(); i++)
+	{
+		std::string index = IntToString((int)i);
+		script += "try{v[" + index + "]=(\n" + expressions[i] + "\n);}catch(x){var q=p(x);e[" + index + "]=[String(x)||'Error',q[1],q[0]==o?'':q[0]];}";
+
+		firstLines[i] = line + 1;
+		line += 2 + (int)std::count(expressions[i].begin(), expressions[i].end(), '\n');
+	}
+
+	script += "return [v,e];})()";
+
+	Awesomium::JSValue result;
+
+	if(evaluate(frame, script, result) && result.getArray().size() == 2)
+	{
+		const Awesomium::JSValue::Array& values = result.getArray()[0].getArray();
+		const Awesomium::JSValue::Array& errors = result.getArray()[1].getArray();
+
+		for(size_t i = 0; i < expressions.size(); i++)
+		{
+			if(i < errors.size() && errors[i].isArray() && errors[i].getArray().size() == 3)
+			{
+				const Awesomium::JSValue::Array& error = errors[i].getArray();
+				std::string source = error[2].toString();
+				int errorLine = error[1].toInteger();
+
+				// Errors raised by the expression itself are reported relative to the expression
+				if(source.empty() && errorLine >= firstLines[i])
+					errorLine -= firstLines[i] - 1;
+
+				parent->setFutureJSError((int)((unsigned int)firstRequestID + i), Awesomium::JSError(error[0].toString(), errorLine, source));
+			}
+			else
+				parent->setFutureJSValue((int)((unsigned int)firstRequestID + i), i < values.size() ? values[i] : Awesomium::JSValue());
+		}
+
+		return;
+	}
+
+	// One of the expressions doesn't even parse (or the frame is gone), evaluate them one at a time to find out which
+	for(size_t i = 0; i < expressions.size(); i++)
+		executeJavascriptWithResult(expressions[i], frameName, (int)((unsigned int)firstRequestID + i));
+}
+
+/**
+* Evaluates a script in the context of a frame and converts the result, returns false if
+* there is no such frame or if the script failed. If 'error' is given, it receives the
+* uncaught exception that made the script fail.
+*/
+bool WebViewProxy::evaluate(WebFrame* frame, const std::string& javascript, Awesomium::JSValue& result, Awesomium::JSError* error)
+{
+	NPObject* windowObject = frame ? frame->windowObject() : 0;
+
+	if(!windowObject)
+		return false;
+
+	NPString script = { javascript.c_str(), (uint32_t)javascript.length() };
+	NPVariant scriptResult;
+
+	// Errors are reported synchronously, while the script runs, so they belong to this request
+	capturedError = error;
+	bool isEvaluated = WebKit::WebBindings::evaluate(0, windowObject, &script, &scriptResult);
+	capturedError = 0;
+
+	if(!isEvaluated)
+		return false;
+
+	// Whatever the script logged on its way to succeeding isn't an error
+	if(error)
+		*error = Awesomium::JSError();
+
+	initFromNPVariant(scriptResult, result);
+	WebKit::WebBindings::releaseVariantValue(&scriptResult);
+
+	return true;
+}
+
+void WebViewProxy::compileFunction(const std::string& source, const std::wstring& frameName, int functionID)
+{
+	WebFrame* frame = getFrame(frameName);
+	NPObject* windowObject = frame ? frame->windowObject() : 0;
+
+	// If this fails, there is simply no entry and invoking the handle reports an error
+	if(!windowObject)
+		return;
+
+	std::string javascript = "(\n" + source + "\n)";
+	NPString script = { javascript.c_str(), (uint32_t)javascript.length() };
+	NPVariant function;
+
+	if(!WebKit::WebBindings::evaluate(0, windowObject, &script, &function))
+		return;
+
+	if(!NPVARIANT_IS_OBJECT(function))
+	{
+		WebKit::WebBindings::releaseVariantValue(&function);
+		return;
+	}
+
+	// The reference that the result held is now ours, until the handle is released or the frame navigates
+	CompiledFunction& compiled = compiledFunctions[functionID];
+	compiled.function = NPVARIANT_TO_OBJECT(function);
+	compiled.frame = frame;
+	compiled.frameName = frameName;
+}
+
+void WebViewProxy::invokeFunction(int functionID, const Awesomium::JSValue::Array& args, int requestID)
+{
+	std::map<int, CompiledFunction>::iterator i = compiledFunctions.find(functionID);
+
+	if(i == compiledFunctions.end())
+	{
+		parent->setFutureJSError(requestID, Awesomium::JSError("The function could not be compiled, or was invalidated by navigation."));
+		return;
+	}
+
+	// A subframe may have been removed by script without navigating
+	if(getFrame(i->second.frameName) != i->second.frame)
+	{
+		releaseFunction(functionID);
+		parent->setFutureJSError(requestID, Awesomium::JSError("The frame that the function was compiled in no longer exists."));
+		return;
+	}
+
+	NPObject* windowObject = i->second.frame->windowObject();
+
+	std::vector<CppVariant> cppArgs(args.size());
+	std::vector<NPVariant> npArgs(args.size());
+
+	for(size_t j = 0; j < args.size(); j++)
+	{
+		initCppVariant(args[j], cppArgs[j], windowObject);
+		npArgs[j] = cppArgs[j];
+	}
+
+	NPVariant callResult;
+	Awesomium::JSError error;
+
+	capturedError = &error;
+	bool isInvoked = WebKit::WebBindings::invokeDefault(0, i->second.function, npArgs.empty() ? 0 : &npArgs[0], (uint32_t)npArgs.size(), &callResult);
+	capturedError = 0;
+
+	if(!isInvoked)
+	{
+		parent->setFutureJSError(requestID, error.isError() ? error : Awesomium::JSError("The function could not be invoked."));
+		return;
+	}
+
+	Awesomium::JSValue result;
+	initFromNPVariant(callResult, result);
+	WebKit::WebBindings::releaseVariantValue(&callResult);
+
+	parent->setFutureJSValue(requestID, result);
+}
+
+void WebViewProxy::releaseFunction(int functionID)
+{
+	std::map<int, CompiledFunction>::iterator i = compiledFunctions.find(functionID);
+
+	if(i != compiledFunctions.end())
+	{
+		WebKit::WebBindings::releaseObject(i->second.function);
+		compiledFunctions.erase(i);
+	}
+}
+
+/**
+* Returns the frame with the given name, or the main frame if the name is empty.
+*/
+WebFrame* WebViewProxy::getFrame(const std::wstring& frameName)
+{
+	return frameName.length() ? view->GetFrameWithName(frameName) : view->GetMainFrame();
+}
+
+/**
+* Releases the functions that were compiled in a frame, or all of them if 'frame' is 0.
+*/
+void WebViewProxy::releaseCompiledFunctions(WebFrame* frame)
+{
+	std::map<int, CompiledFunction>::iterator i = compiledFunctions.begin();
+
+	while(i != compiledFunctions.end())
+	{
+		if(!frame || i->second.frame == frame)
+		{
+			WebKit::WebBindings::releaseObject(i->second.function);
+			compiledFunctions.erase(i++);
+		}
+		else
+			i++;
+	}
 }
 
 void WebViewProxy::setProperty(const std::string& name, const Awesomium::JSValue& value)
@@ -209,9 +651,19 @@ void WebViewProxy::setProperty(const std::string& name, const Awesomium::JSValue
 	clientObject->setProperty(name, value);
 }
 
-void WebViewProxy::setCallback(const std::string& name)
+void WebViewProxy::setCallback(const std::string& name, Awesomium::CoreThreadCallback* coreThreadHandler, Awesomium::CallbackHandler* handler)
+{
+	clientObject->setCallback(name, coreThreadHandler, handler);
+}
+
+void WebViewProxy::setCallbackPolicy(const std::string& name, Awesomium::CallbackPolicy policy, int maxPerSecond)
+{
+	clientObject->setCallbackPolicy(name, policy, maxPerSecond);
+}
+
+void WebViewProxy::setCallbackReceivesBuffers(const std::string& name, bool receivesBuffers)
 {
-	clientObject->setCallback(name);
+	clientObject->setCallbackReceivesBuffers(name, receivesBuffers);
 }
 
 void WebViewProxy::mayBeginRender()
@@ -363,8 +815,30 @@ void WebViewProxy::copyRenderBuffer(unsigned char* destination, int destRowSpan,
 	renderBufferLock->Unlock();
 }
 
+/**
+* Arms the render timer if asynchronous rendering is enabled and it isn't armed already. Renders are
+* spaced at least 1/maxAsyncRenderPerSec apart, but nothing is scheduled while the view is clean.
+*/
+void WebViewProxy::scheduleAsyncRender()
+{
+	if(!enableAsyncRendering || !parent || renderTimer.IsRunning())
+		return;
+
+	base::TimeDelta interval = base::TimeDelta::FromMilliseconds(1000 / maxAsyncRenderPerSec);
+	base::TimeDelta sinceLastRender = base::TimeTicks::Now() - lastAsyncRenderTime;
+
+	renderTimer.Start(sinceLastRender < interval ? interval - sinceLastRender : base::TimeDelta(), this, &WebViewProxy::renderAsync);
+}
+
 void WebViewProxy::renderAsync()
 {
+	Awesomium::WebCore::Get().coreProxy->countWakeup();
+
+	// Input always goes ahead of a render
+	if(hasPendingInput())
+		flushInput();
+
+	lastAsyncRenderTime = base::TimeTicks::Now();
 	render();
 }
 
@@ -379,6 +853,61 @@ void WebViewProxy::renderSync(unsigned char* destination, int destRowSpan, int d
 	parent->setFinishRender();
 }
 
+/**
+* Renders in response to WebView::requestRender. The result is published to 'frameBuffer' so that the
+* host can collect it (via copyRenderedFrame) while we go on to render the next one into 'renderBuffer'.
+*/
+void WebViewProxy::renderRequested()
+{
+	gfx::Rect invalidArea = render();
+
+	renderBufferLock->Lock();
+
+	if(!frameBuffer)
+	{
+		frameBuffer = new Awesomium::RenderBuffer(width, height);
+		frameBuffer->copyFrom(renderBuffer->buffer, renderBuffer->rowSpan);
+		frameRect = gfx::Rect(width, height);
+	}
+	else if(!invalidArea.IsEmpty())
+	{
+		frameBuffer->copyArea(renderBuffer->buffer + invalidArea.y()*renderBuffer->rowSpan + invalidArea.x()*4, 
+			renderBuffer->rowSpan, invalidArea);
+		frameRect = frameRect.Union(invalidArea);
+	}
+
+	isFrameReady = true;
+
+	renderBufferLock->Unlock();
+
+	parent->setDirty(false);
+}
+
+/**
+* Called from the host thread.
+*/
+bool WebViewProxy::copyRenderedFrame(unsigned char* destination, int destRowSpan, int destDepth, Awesomium::Rect* renderedRect)
+{
+	renderBufferLock->Lock();
+
+	bool result = isFrameReady;
+
+	if(isFrameReady)
+	{
+		frameBuffer->copyTo(destination, destRowSpan, destDepth, Awesomium::WebCore::GetPointer()->getPixelFormat() == Awesomium::PF_RGBA);
+
+		if(renderedRect)
+			*renderedRect = Awesomium::Rect(frameRect.x(), frameRect.y(), frameRect.width(), frameRect.height());
+
+		frameRect = gfx::Rect();
+		isFrameReady = false;
+	}
+
+	renderBufferLock->Unlock();
+
+	return result;
+}
+
 void WebViewProxy::paint()
 {
 	if(!dirtyArea.IsEmpty() && needsPainting)
@@ -389,6 +918,98 @@ void WebViewProxy::paint()
 	}
 }
 
+/**
+* Called from the host thread. Consecutive mouse-moves are collapsed to the latest position and consecutive
+* mouse-wheels are summed so that a burst of high-frequency input only costs WebKit a single event.
+*
+* Returns true if a call to flushInput needs to be posted to the core thread.
+*/
+bool WebViewProxy::queueInput(const QueuedInputEvent& event)
+{
+	bool needsFlush = false;
+
+	inputQueueLock->Lock();
+
+	numInputInjected++;
+
+	QueuedInputEvent* lastEvent = pendingInput.size() ? &pendingInput.back() : 0;
+
+	if(lastEvent && event.type == QueuedInputEvent::MOUSE_MOVE && lastEvent->type == QueuedInputEvent::MOUSE_MOVE)
+	{
+		lastEvent->x = event.x;
+		lastEvent->y = event.y;
+		numInputCoalesced++;
+	}
+	else if(lastEvent && event.type == QueuedInputEvent::MOUSE_WHEEL && lastEvent->type == QueuedInputEvent::MOUSE_WHEEL)
+	{
+		lastEvent->x += event.x;
+		lastEvent->y += event.y;
+		numInputCoalesced++;
+	}
+	else
+	{
+		pendingInput.push_back(event);
+
+		needsFlush = !isInputFlushPending;
+		isInputFlushPending = true;
+	}
+
+	inputQueueLock->Unlock();
+
+	return needsFlush;
+}
+
+void WebViewProxy::flushInput()
+{
+	inputQueueLock->Lock();
+	dispatchingInput.swap(pendingInput);
+	isInputFlushPending = false;
+	inputQueueLock->Unlock();
+
+	for(std::vector<QueuedInputEvent>::iterator i = dispatchingInput.begin(); i != dispatchingInput.end(); i++)
+	{
+		switch(i->type)
+		{
+		case QueuedInputEvent::MOUSE_MOVE:
+			injectMouseMove(i->x, i->y);
+			break;
+		case QueuedInputEvent::MOUSE_DOWN:
+			injectMouseDown(i->button);
+			break;
+		case QueuedInputEvent::MOUSE_UP:
+			injectMouseUp(i->button);
+			break;
+		case QueuedInputEvent::MOUSE_WHEEL:
+			injectMouseWheel(i->x, i->y);
+			break;
+		case QueuedInputEvent::KEY:
+			injectKeyEvent(i->press, i->modifiers, i->windowsCode, i->nativeCode);
+			break;
+		case QueuedInputEvent::TEXT:
+			injectTextEvent(i->text);
+			break;
+		case QueuedInputEvent::KEYBOARD:
+#if defined(_WIN32)
+			injectKeyboardEvent(i->hwnd, i->message, i->wparam, i->lparam);
+#elif defined(__APPLE__)
+			injectKeyboardEvent(i->keyboardEvent);
+#endif
+			break;
+		}
+	}
+
+	// Keep the capacity around so that steady-state input doesn't allocate
+	dispatchingInput.clear();
+}
+
+void WebViewProxy::getInputStats(int& numInjected, int& numCoalesced)
+{
+	inputQueueLock->Lock();
+	numInjected = numInputInjected;
+	numCoalesced = numInputCoalesced;
+	inputQueueLock->Unlock();
+}
+
 void WebViewProxy::injectMouseMove(int x, int y)
 {
 	mouseX = x;
@@ -560,11 +1181,60 @@ void WebViewProxy::getContentAsText(std::wstring* result, int maxChars)
 
 	if(frame) {
         WebKit::WebString text (frame->contentAsText(maxChars));
-        *result = WebStringToWString(text);
+        *result = UTF16ToWide(webkit_glue::WebStringToString16(text));
     }
 	parent->setFinishGetContentText();
 }
 
+void WebViewProxy::requestContentAsText(Awesomium::ContentTextHandler* handler, int maxChars, Awesomium::TextEncoding encoding, int chunkSize)
+{
+	ContentTextRequest* request = new ContentTextRequest(handler, encoding, chunkSize > 0 ? chunkSize : 0);
+
+	// WebKit only offers the text in one piece, it's the conversion and delivery that we spread out
+	WebFrame* frame = view->GetMainFrame();
+	if(frame)
+		request->text = webkit_glue::WebStringToString16(frame->contentAsText(maxChars));
+
+	// The remaining chunks are delivered from our scheduler slices, in turn with the other WebViews
+	if(!deliverContentText(request))
+	{
+		pendingContentText.push_back(request);
+		Awesomium::WebCore::Get().coreProxy->scheduleView(this);
+	}
+}
+
+/**
+* Delivers the next chunk of a streamed getContentAsText, returns true (and deletes the request)
+* once the last chunk has been delivered.
+*/
+bool WebViewProxy::deliverContentText(ContentTextRequest* request)
+{
+	size_t remaining = request->text.length() - request->offset;
+	size_t length = request->chunkSize && request->chunkSize < remaining ? request->chunkSize : remaining;
+
+	// Don't split a surrogate pair across two chunks: end before its high surrogate, or take the whole
+	// pair if that is all the chunk holds (a chunk size of 1 still makes progress)
+	if(length < remaining && (request->text[request->offset + length - 1] & 0xFC00) == 0xD800)
+	{
+		if(length > 1)
+			length--;
+		else
+			length++;
+	}
+
+	string16 chunk = request->text.substr(request->offset, length);
+	request->offset += length;
+	bool isFinished = request->offset >= request->text.length();
+
+	Awesomium::WebCore::Get().queueEvent(new WebViewEvents::ReceiveContentText(parent, request->handler, request->encoding, 
+		chunk, isFinished ? (int)request->text.length() : -1));
+
+	if(isFinished)
+		delete request;
+
+	return isFinished;
+}
+
 void WebViewProxy::zoomIn()
 {
 	view->ZoomIn(false);
@@ -600,6 +1270,17 @@ void WebViewProxy::resize(int width, int height)
 		backBuffer = new Awesomium::RenderBuffer(width, height);
 	}
 
+	if(frameBuffer)
+	{
+		// A frame rendered at the old size is of no use to the host anymore
+		renderBufferLock->Lock();
+		delete frameBuffer;
+		frameBuffer = 0;
+		frameRect = gfx::Rect();
+		isFrameReady = false;
+		renderBufferLock->Unlock();
+	}
+
 	view->resize(gfx::Size(width, height));
 
 	didInvalidateRect(WebKit::WebRect(0, 0, width, height));
@@ -626,6 +1307,7 @@ void WebViewProxy::invalidatePopups()
 		parent->setDirty();
 
 	isPopupsDirty = true;
+	scheduleAsyncRender();
 }
 
 void WebViewProxy::AddRef()
@@ -781,8 +1463,14 @@ void WebViewProxy::DidStopLoading(::WebView* webview)
 // using the original version of this function.
 void WebViewProxy::WindowObjectCleared(WebFrame* webframe)
 {
+	// Compiled functions belong to the context that is going away; when the main frame navigates, its
+	// subframes go away too
+	releaseCompiledFunctions(webframe == view->GetMainFrame() ? 0 : webframe);
+
 	clientObject->BindToJavascript(webframe, L"Client");
-	clientObject->initInternalCallbacks();
+
+	if(webframe == view->GetMainFrame())
+		clientObject->setWindowFrame(webframe);
 }
 
 // PolicyDelegate ----------------------------------------------------------
@@ -1063,13 +1751,13 @@ void WebViewProxy::AddMessageToConsole(::WebView* webview, const std::wstring& m
 {
 	LOG(INFO) << "Javascript Error in " << source_id << " at line " << line_no << ": " << message; 
 
-	// When Javascript is executed with an asynchronous result via WebView::executeJavascriptWithResult and the user
-	// attempts to retrieve the FutureJSValue, the calling thread will block until the result is received. The problem
-	// is that if a Javascript error is encountered during evaluation of the Javascript, the FutureJSValue is never propagated
-	// from ClientObject and so we must take this extra precaution to nullify and signal all current FutureJSValue callbacks.
-	// Also, Javascript executed via the method described above usually ends up interpreted as line #1, hence line_no == 1.
-	if(line_no == 1)
-		parent->nullifyFutureJSValueCallbacks();
+	// Attribute the message to the request whose script is running right now, if any. The uncaught
+	// exception that makes a script fail is reported last, just before the script returns.
+	if(capturedError)
+		*capturedError = Awesomium::JSError(WideToUTF8(message), (int)line_no, WideToUTF8(source_id));
+
+	if(pendingConsoleMessages->add(Awesomium::ConsoleMessage(message, (int)line_no, source_id)))
+		Awesomium::WebCore::Get().queueEvent(new WebViewEvents::ReceiveConsoleMessages(parent, pendingConsoleMessages));
 }
 
 // UIDelegate --------------------------------------------------------------
@@ -1364,6 +2052,7 @@ void WebViewProxy::didInvalidateRect(const WebKit::WebRect& rect)
 	{
 		parent->setDirty();
 		needsPainting = true;
+		scheduleAsyncRender();
 	}
 }
 
@@ -1381,6 +2070,7 @@ void WebViewProxy::didScrollRect(int dx, int dy, const WebKit::WebRect& clip_rec
 		(*i)->didScrollWebView(dx, dy);
 
 	isPopupsDirty = true;
+	scheduleAsyncRender();
 }
 
 // This method is called to instruct the window containing the WebWidget to
@@ -1546,9 +2236,26 @@ void WebViewProxy::closePopup(PopupWidget* popup)
 	}
 }
 
+void WebViewProxy::setFocus(bool isFocused)
+{
+	view->setFocus(isFocused);
+	checkKeyboardFocus();
+}
+
+/**
+* Works out whether the keyboard is focused (the focused node of the focused frame is editable) straight from
+* WebKit: queryCompositionStatus reports on the focused frame's editor and selection without touching script,
+* so neither the page's getters nor its DOM methods run on every check.
+*/
 void WebViewProxy::checkKeyboardFocus()
 {
-	executeJavascript("Client.____checkKeyboardFocus(document.activeElement != document.body)");
+	bool isIMEEnabled = false;
+	WebKit::WebRect caretRect;
+
+	bool isFocused = view->queryCompositionStatus(&isIMEEnabled, &caretRect);
+
+	// We're already on the core thread, this queues ChangeKeyboardFocus if the state changed
+	parent->handleCheckKeyboardFocus(isFocused);
 }
 
 void WebViewProxy::overrideIFrameWindow(const std::wstring& frameName)
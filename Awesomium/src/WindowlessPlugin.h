@@ -58,6 +58,7 @@ public:
 #if defined(__APPLE__)
 		npCgContext.window = 0;
 #endif
+		Awesomium::WebCore::Get().pluginCreated();
 	}
 
 	~WindowlessPlugin()
@@ -67,6 +68,7 @@ public:
 		if(npCgContext.window)
 			DisposeWindow(npCgContext.window);
 #endif
+		Awesomium::WebCore::Get().pluginDestroyed();
 		
 		LOG(INFO) << "A WindowlessPlugin has been destroyed";
 	}
@@ -25,7 +25,7 @@ using namespace Awesomium;
 #define ASYNC_RENDER 1
 #define SUPER_QUALITY 0
 
-class Application : public OIS::MouseListener, public OIS::KeyListener, public HookListener, public WebViewListener
+class Application : public OIS::MouseListener, public OIS::KeyListener, public HookListener, public WebViewListener, public CallbackHandler
 {
 public:
 	bool shouldQuit;
@@ -166,7 +166,7 @@ public:
 
 		view->setProperty("welcomeMsg", "Hey there, thanks for checking out the Awesomium v1.0 Demo.");
 		view->setProperty("renderSystem", Root::getSingleton().getRenderSystem()->getName());
-		view->setCallback("requestFPS");
+		view->setCallback("requestFPS", this);
 		view->setListener(this);
 
 		view->loadFile("demo.html");
@@ -377,12 +377,14 @@ public:
 
 	void onCallback(const std::string& name, const Awesomium::JSArguments& args)
 	{
-		if(name == "requestFPS")
-		{
-			const RenderTarget::FrameStats& stats = viewport->getTarget()->getStatistics();
-			view->setProperty("fps", (int)stats.lastFPS);
-			view->executeJavascript("updateFPS()");
-		}
+	}
+
+	// Called for 'Client.requestFPS()' only
+	void handleCallback(WebView* caller, const std::string& name, const Awesomium::JSArguments& args)
+	{
+		const RenderTarget::FrameStats& stats = viewport->getTarget()->getStatistics();
+		view->setProperty("fps", (int)stats.lastFPS);
+		view->executeJavascript("updateFPS()");
 	}
 	
 	void onReceiveTitle(const std::wstring& title, const std::wstring& frameName)
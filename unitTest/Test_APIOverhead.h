@@ -0,0 +1,223 @@
+#include "TestFramework.h"
+#include "WebCore.h"
+#include <windows.h>
+#include <process.h>
+#include <deque>
+#include <stdio.h>
+
+#define LENGTH_SEC	5
+#define CALLS_PER_FRAME	20
+#define FRAMES_PER_SYNC	10	// Keeps every burst below the command ring's capacity, so calls never block on it
+
+/**
+* Reproduces how each WebView call used to reach the core thread before the command ring: a heap-allocated
+* task holding copies of the arguments (NewRunnableMethod), pushed onto a locked queue that signals the
+* consumer on every post (MessageLoop::PostTask with the default pump). Gives the 'before' figure.
+*/
+class PerCallTaskPoster
+{
+	struct SetPropertyTask
+	{
+		std::string name;
+		Awesomium::JSValue value;
+		SetPropertyTask(const std::string& name, const Awesomium::JSValue& value) : name(name), value(value) {}
+	};
+
+	CRITICAL_SECTION lock;
+	std::deque<SetPropertyTask*> incoming;
+	HANDLE workEvent, idleEvent, thread;
+	bool isQuitting;
+
+	static unsigned __stdcall threadMain(void* data)
+	{
+		PerCallTaskPoster* self = (PerCallTaskPoster*)data;
+		std::deque<SetPropertyTask*> work;
+
+		while(true)
+		{
+			WaitForSingleObject(self->workEvent, INFINITE);
+
+			EnterCriticalSection(&self->lock);
+			work.swap(self->incoming);
+			bool isQuitting = self->isQuitting;
+			LeaveCriticalSection(&self->lock);
+
+			for(size_t i = 0; i < work.size(); i++)
+				delete work[i];
+
+			work.clear();
+			SetEvent(self->idleEvent);
+
+			if(isQuitting)
+				return 0;
+		}
+	}
+
+public:
+	PerCallTaskPoster() : isQuitting(false)
+	{
+		InitializeCriticalSection(&lock);
+		workEvent = CreateEvent(0, FALSE, FALSE, 0);
+		idleEvent = CreateEvent(0, FALSE, FALSE, 0);
+		thread = (HANDLE)_beginthreadex(0, 0, threadMain, this, 0, 0);
+	}
+
+	~PerCallTaskPoster()
+	{
+		EnterCriticalSection(&lock);
+		isQuitting = true;
+		LeaveCriticalSection(&lock);
+		SetEvent(workEvent);
+
+		WaitForSingleObject(thread, INFINITE);
+		CloseHandle(thread);
+		CloseHandle(idleEvent);
+		CloseHandle(workEvent);
+		DeleteCriticalSection(&lock);
+	}
+
+	void setProperty(const std::string& name, const Awesomium::JSValue& value)
+	{
+		SetPropertyTask* task = new SetPropertyTask(name, value);
+
+		EnterCriticalSection(&lock);
+		incoming.push_back(task);
+		LeaveCriticalSection(&lock);
+
+		SetEvent(workEvent);
+	}
+
+	void sync()
+	{
+		ResetEvent(idleEvent);
+		SetEvent(workEvent);
+		WaitForSingleObject(idleEvent, INFINITE);
+	}
+};
+
+class Test_APIOverhead : public Test
+{
+	Awesomium::WebView* webView;
+	LARGE_INTEGER frequency;
+
+	double getSeconds()
+	{
+		LARGE_INTEGER now;
+		QueryPerformanceCounter(&now);
+		return now.QuadPart / (double)frequency.QuadPart;
+	}
+
+public:
+	Test_APIOverhead() : Test("APIOverhead")
+	{
+		QueryPerformanceFrequency(&frequency);
+		webView = Awesomium::WebCore::Get().createWebView(15, 15);
+		webView->loadHTML("<html><body></body></html>");
+		Sleep(100);
+	}
+
+	~Test_APIOverhead()
+	{
+		webView->destroy();
+	}
+
+	bool run()
+	{
+		log("Running");
+
+		// setProperty is never coalesced or dropped under the default queue policy, and carries a string
+		// argument, so each call pays for one full submission.
+		Awesomium::JSValue value(std::string("a string argument that doesn't fit in a small buffer"));
+
+		timer t;
+		t.start();
+		int frameCount = 0;
+		int taskCount = 0;
+		double taskSeconds = 0;
+
+		// Measure the old per-call task path (caller side only, the time spent waiting for the consumer is excluded)
+		{
+			PerCallTaskPoster poster;
+
+			while(t.elapsed_time() < LENGTH_SEC)
+			{
+				double start = getSeconds();
+
+				for(int i = 0; i < CALLS_PER_FRAME; i++)
+					poster.setProperty("value", value);
+
+				taskSeconds += getSeconds() - start;
+				taskCount += CALLS_PER_FRAME;
+
+				if(++frameCount % FRAMES_PER_SYNC == 0)
+					poster.sync();
+			}
+		}
+
+		t.restart();
+		frameCount = 0;
+		int callCount = 0;
+		double callSeconds = 0;
+
+		// Measure the same calls issued one by one through the command ring
+		while(t.elapsed_time() < LENGTH_SEC)
+		{
+			double start = getSeconds();
+
+			for(int i = 0; i < CALLS_PER_FRAME; i++)
+				webView->setProperty("value", value);
+
+			callSeconds += getSeconds() - start;
+			callCount += CALLS_PER_FRAME;
+
+			// Wait for the core thread to catch up every so often
+			if(++frameCount % FRAMES_PER_SYNC == 0)
+				webView->resize(15, 15);
+		}
+
+		webView->resize(15, 15);
+
+		t.restart();
+		frameCount = 0;
+		int batchedCallCount = 0;
+		double batchedCallSeconds = 0;
+
+		// Measure the cost of issuing the same calls in batches
+		while(t.elapsed_time() < LENGTH_SEC)
+		{
+			double start = getSeconds();
+
+			webView->beginBatch();
+
+			for(int i = 0; i < CALLS_PER_FRAME; i++)
+				webView->setProperty("value", value);
+
+			webView->endBatch();
+
+			batchedCallSeconds += getSeconds() - start;
+			batchedCallCount += CALLS_PER_FRAME;
+
+			if(++frameCount % FRAMES_PER_SYNC == 0)
+				webView->resize(15, 15);
+		}
+
+		webView->resize(15, 15);
+
+		if(!taskSeconds || !callSeconds || !batchedCallSeconds)
+		{
+			log("Test failed, no time was measured");
+			return false;
+		}
+
+		logTestValue("APIOverhead_TaskPostsPerSec", taskCount / taskSeconds);
+		logTestValue("APIOverhead_CallsPerSec", callCount / callSeconds);
+		logTestValue("APIOverhead_BatchedCallsPerSec", batchedCallCount / batchedCallSeconds);
+
+		char summary[128];
+		sprintf(summary, "Per-call overhead: %.0f ns with tasks, %.0f ns with the command ring, %.0f ns batched",
+			1e9 * taskSeconds / taskCount, 1e9 * callSeconds / callCount, 1e9 * batchedCallSeconds / batchedCallCount);
+		log(summary);
+
+		return true;
+	}
+};
@@ -0,0 +1,108 @@
+#include "TestFramework.h"
+#include "WebCore.h"
+#include "WebViewAwaitables.h"
+#include <windows.h>
+
+#define LENGTH_SEC	5
+#define TIMEOUT_SEC	30
+
+#if AWESOMIUM_HAS_COROUTINES
+/**
+* A coroutine that starts right away and cleans up after itself, the test
+* keeps track of its progress through the flags it sets.
+*/
+struct TestCoroutine
+{
+	struct promise_type
+	{
+		TestCoroutine get_return_object() { return TestCoroutine(); }
+		std::suspend_never initial_suspend() { return std::suspend_never(); }
+		std::suspend_never final_suspend() noexcept { return std::suspend_never(); }
+		void return_void() {}
+		void unhandled_exception() { std::terminate(); }
+	};
+};
+#endif
+
+class Test_Coroutines : public Test
+{
+	Awesomium::WebView* webView;
+	bool isFinished;
+	bool hasFailed;
+	int awaitCount;
+public:
+	Test_Coroutines() : Test("Coroutines"), isFinished(false), hasFailed(false), awaitCount(0)
+	{
+		webView = Awesomium::WebCore::Get().createWebView(15, 15);
+	}
+
+	~Test_Coroutines()
+	{
+		webView->destroy();
+	}
+
+	bool run()
+	{
+		log("Running");
+
+#if AWESOMIUM_HAS_COROUTINES
+		timer t;
+		t.start();
+
+		// The coroutine suspends at its first co_await, it is resumed from WebCore::update
+		runCoroutine();
+
+		while(!isFinished && t.elapsed_time() < TIMEOUT_SEC)
+			Awesomium::WebCore::Get().update();
+
+		if(!isFinished)
+		{
+			log("Test failed, the coroutine was never resumed");
+			return false;
+		}
+
+		if(hasFailed)
+		{
+			log("Test failed, incorrect result returned to the coroutine");
+			return false;
+		}
+
+		logTestValue("Coroutines_AwaitedEvalsPerSec", awaitCount / (double)LENGTH_SEC);
+
+		return true;
+#else
+		log("Skipped, this compiler doesn't support coroutines");
+
+		return true;
+#endif
+	}
+
+#if AWESOMIUM_HAS_COROUTINES
+	TestCoroutine runCoroutine()
+	{
+		co_await Awesomium::loadURLAsync(webView, "about:blank");
+
+		Awesomium::JSValue result = co_await Awesomium::evalAsync(webView, "var counter = 0; document.title = 'awesomium'");
+
+		if(result.toString() != "awesomium")
+			hasFailed = true;
+
+		timer t;
+		t.start();
+
+		// Measure evaluations that are awaited one after another
+		while(!hasFailed && t.elapsed_time() < LENGTH_SEC)
+		{
+			result = co_await Awesomium::evalAsync(webView, "++counter");
+
+			if(result.toInteger() != ++awaitCount)
+				hasFailed = true;
+		}
+
+		co_await Awesomium::evalAsync(webView, "document.body.style.background = 'red'");
+		co_await Awesomium::nextFrame(webView);
+
+		isFinished = true;
+	}
+#endif
+};
@@ -0,0 +1,184 @@
+#include "TestFramework.h"
+#include "WebCore.h"
+#include <windows.h>
+
+#define LENGTH_SEC	5
+#define CALLS_PER_SYNC	100
+
+class Test_ExecuteJavascript : public Test, public Awesomium::WebViewListener, public Awesomium::CoreThreadCallback
+{
+	Awesomium::WebView* webView;
+	bool hasLoaded;
+public:
+	Test_ExecuteJavascript() : Test("ExecuteJavascript"), hasLoaded(false)
+	{
+		webView = Awesomium::WebCore::Get().createWebView(15, 15);
+		webView->setListener(this);
+		webView->loadHTML("<html><body><script type='text/javascript'>var counter = 0;</script></body></html>");
+	}
+
+	~Test_ExecuteJavascript()
+	{
+		webView->setListener(0);
+		webView->destroy();
+	}
+
+	bool run()
+	{
+		log("Running");
+		log("Waiting for page to load...");
+		while(!hasLoaded)
+		{
+			Awesomium::WebCore::Get().update();
+			Sleep(50);
+		}
+		log("Page loaded, running Javascript test");
+
+		timer t;
+		t.start();
+		int callCount = 0;
+
+		// Measure fire-and-forget execution, syncing up with the page every so often
+		while(t.elapsed_time() < LENGTH_SEC)
+		{
+			for(int i = 0; i < CALLS_PER_SYNC; i++)
+				webView->executeJavascript("counter++");
+
+			callCount += CALLS_PER_SYNC;
+
+			if(webView->executeJavascriptWithResult("counter").get().toInteger() != callCount)
+			{
+				log("Test failed, some scripts were not executed");
+				return false;
+			}
+		}
+
+		logTestValue("ExecuteJavascript_CallsPerSec", callCount / (double)LENGTH_SEC);
+
+		t.restart();
+		int resultCount = 0;
+
+		// Measure round-trips that return structured data
+		while(t.elapsed_time() < LENGTH_SEC)
+		{
+			Awesomium::JSValue result = webView->executeJavascriptWithResult("({ values: [1, 2, counter], name: 'awesomium' })").get();
+
+			if(result.getObject()["values"].getArray().size() != 3 || result.getObject()["name"].toString() != "awesomium")
+			{
+				log("Test failed, incorrect structure returned");
+				return false;
+			}
+
+			resultCount++;
+		}
+
+		logTestValue("ExecuteJavascript_StructuredResultsPerSec", resultCount / (double)LENGTH_SEC);
+
+		std::vector<std::string> expressions;
+		for(int i = 0; i < CALLS_PER_SYNC; i++)
+			expressions.push_back(i == CALLS_PER_SYNC / 2 ? "counter,\nundefinedFunction()" : "counter + " + std::string(1, '0' + (i % 10)));
+
+		t.restart();
+		int expressionCount = 0;
+
+		// Measure batches of expressions evaluated in a single round-trip, one of which throws
+		while(t.elapsed_time() < LENGTH_SEC)
+		{
+			std::vector<Awesomium::FutureJSValue> results = webView->evaluateBatch(expressions);
+
+			for(int i = 0; i < CALLS_PER_SYNC; i++)
+			{
+				Awesomium::JSValue result = results[i].get();
+
+				if(results[i].hasError() != (i == CALLS_PER_SYNC / 2) || (!results[i].hasError() && result.toInteger() != callCount + (i % 10)))
+				{
+					log("Test failed, incorrect batch result returned");
+					return false;
+				}
+
+				// The error is reported on the second line of the expression, not of the batch script
+				if(results[i].hasError() && results[i].getError().line != 2)
+				{
+					log("Test failed, incorrect line reported for a batched expression");
+					return false;
+				}
+			}
+
+			expressionCount += CALLS_PER_SYNC;
+		}
+
+		logTestValue("ExecuteJavascript_BatchedExpressionsPerSec", expressionCount / (double)LENGTH_SEC);
+
+		Awesomium::JSFunction add = webView->compileFunction("function(a, b) { return a + b + counter; }");
+		Awesomium::JSArguments args(2);
+
+		t.restart();
+		int invokeCount = 0;
+
+		// Measure calls to a function that was compiled once, passing native arguments
+		while(t.elapsed_time() < LENGTH_SEC)
+		{
+			std::vector<Awesomium::FutureJSValue> results;
+
+			for(int i = 0; i < CALLS_PER_SYNC; i++)
+			{
+				args[0] = i;
+				args[1] = 0.5;
+				results.push_back(add.invoke(args));
+			}
+
+			for(int i = 0; i < CALLS_PER_SYNC; i++)
+			{
+				if(results[i].get().toDouble() != i + 0.5 + callCount)
+				{
+					log("Test failed, incorrect result returned by a compiled function");
+					return false;
+				}
+			}
+
+			invokeCount += CALLS_PER_SYNC;
+		}
+
+		add.release();
+
+		logTestValue("ExecuteJavascript_CompiledInvokesPerSec", invokeCount / (double)LENGTH_SEC);
+
+		webView->setCallback("double", this);
+
+		t.restart();
+		int syncCallCount = 0;
+
+		// Measure callbacks that are answered from within the Javascript call
+		while(t.elapsed_time() < LENGTH_SEC)
+		{
+			if(webView->executeJavascriptWithResult("var sum = 0; for(var i = 0; i < 100; i++) sum += Client.double(i); sum").get().toInteger() != 9900)
+			{
+				log("Test failed, incorrect result returned by a synchronous callback");
+				return false;
+			}
+
+			syncCallCount += CALLS_PER_SYNC;
+		}
+
+		logTestValue("ExecuteJavascript_SyncCallbacksPerSec", syncCallCount / (double)LENGTH_SEC);
+
+		return true;
+	}
+
+	void onBeginNavigation(const std::string& url, const std::wstring& frameName) {}
+	void onBeginLoading(const std::string& url, const std::wstring& frameName, int statusCode, const std::wstring& mimeType) {}
+	void onFinishLoading() { hasLoaded = true; }
+	void onCallback(const std::string& name, const Awesomium::JSArguments& args) {}
+	void onReceiveTitle(const std::wstring& title, const std::wstring& frameName) {}
+	void onChangeTooltip(const std::wstring& tooltip) {}
+#if defined(_WIN32)
+	void onChangeCursor(const HCURSOR& cursor) {}
+#endif
+	void onChangeKeyboardFocus(bool isFocused) {}
+	void onChangeTargetURL(const std::string& url) {}
+
+	Awesomium::JSValue handleCallback(Awesomium::WebView* caller, const std::string& name, const Awesomium::JSArguments& args)
+	{
+		return args.size() ? args[0].toInteger() * 2 : 0;
+	}
+};
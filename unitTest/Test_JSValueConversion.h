@@ -0,0 +1,70 @@
+#include "TestFramework.h"
+#include "WebCore.h"
+#include <windows.h>
+
+#define LENGTH_SEC	5
+#define CONVERSIONS_PER_CHECK	1000
+
+class Test_JSValueConversion : public Test
+{
+public:
+	Test_JSValueConversion() : Test("JSValueConversion")
+	{
+	}
+
+	bool run()
+	{
+		log("Running");
+
+		char buffer[64];
+
+		// Check the conversions first, they must not depend on the locale
+		if(Awesomium::JSValue(42).toString(buffer, sizeof(buffer)) != 2 || std::string(buffer) != "42" ||
+			Awesomium::JSValue(-0.5).toString() != "-0.5" || Awesomium::JSValue("3.25").toDouble() != 3.25 ||
+			Awesomium::JSValue(" -17px").toInteger() != -17 || !Awesomium::JSValue("true").toBoolean() ||
+			Awesomium::JSValue(1234567.0).toString(buffer, 4) != 11 || std::string(buffer) != "1.2")
+		{
+			log("Test failed, incorrect conversion");
+			return false;
+		}
+
+		Awesomium::JSValue numbers[4] = { Awesomium::JSValue(1234567), Awesomium::JSValue(-89), 
+			Awesomium::JSValue(3.14159), Awesomium::JSValue(0.000125) };
+		Awesomium::JSValue strings[4] = { Awesomium::JSValue("1234567"), Awesomium::JSValue("-89"), 
+			Awesomium::JSValue("3.14159"), Awesomium::JSValue("1.25e-4") };
+
+		timer t;
+		t.start();
+		int formatCount = 0;
+		size_t totalLength = 0;
+
+		// Measure formatting numbers into a buffer of our own
+		while(t.elapsed_time() < LENGTH_SEC)
+		{
+			for(int i = 0; i < CONVERSIONS_PER_CHECK; i++)
+				totalLength += numbers[i % 4].toString(buffer, sizeof(buffer));
+
+			formatCount += CONVERSIONS_PER_CHECK;
+		}
+
+		logTestValue("JSValueConversion_FormatsPerSec", formatCount / (double)LENGTH_SEC);
+
+		t.restart();
+		int parseCount = 0;
+		double total = 0;
+
+		// Measure parsing numbers out of strings
+		while(t.elapsed_time() < LENGTH_SEC)
+		{
+			for(int i = 0; i < CONVERSIONS_PER_CHECK; i++)
+				total += (i & 1) ? strings[i % 4].toDouble() : strings[i % 4].toInteger();
+
+			parseCount += CONVERSIONS_PER_CHECK;
+		}
+
+		logTestValue("JSValueConversion_ParsesPerSec", parseCount / (double)LENGTH_SEC);
+
+		// Keep the results alive so that the loops aren't optimized away
+		return totalLength > 0 && total != 0;
+	}
+};
@@ -45,11 +45,33 @@ public:
 			Sleep(1);
 		}
 
-		delete[] buffer;
-
 		logTestValue("RenderSync_LoopCount", loopCount / (double)LENGTH_SEC);
 		logTestValue("RenderSync_RenderCount", renderCount / (double)LENGTH_SEC);
 
+		log("Running pipelined");
+
+		// The frame requested during one loop is collected during the next
+		t.restart();
+		loopCount = 0;
+		renderCount = 0;
+
+		while(t.elapsed_time() < LENGTH_SEC)
+		{
+			if(webView->tryGetRenderedFrame(buffer, WIDTH * 4, 4))
+				renderCount++;
+
+			if(webView->isDirty())
+				webView->requestRender();
+
+			loopCount++;
+			Sleep(1);
+		}
+
+		delete[] buffer;
+
+		logTestValue("RenderSync_PipelinedLoopCount", loopCount / (double)LENGTH_SEC);
+		logTestValue("RenderSync_PipelinedRenderCount", renderCount / (double)LENGTH_SEC);
+
 		return true;
 	}
 };
\ No newline at end of file
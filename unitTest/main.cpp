@@ -3,6 +3,10 @@
 #include "Test_RenderSync.h"
 #include "Test_RenderAsync.h"
 #include "Test_EvalJavascript.h"
+#include "Test_ExecuteJavascript.h"
+#include "Test_APIOverhead.h"
+#include "Test_JSValueConversion.h"
+#include "Test_Coroutines.h"
 #include <conio.h>
 #include <stdio.h>
 #include <vector>
@@ -18,6 +22,10 @@ int main()
 	tests.push_back(new Constructor<Test_RenderSync>());
 	tests.push_back(new Constructor<Test_RenderAsync>());
 	tests.push_back(new Constructor<Test_EvalJavascript>());
+	tests.push_back(new Constructor<Test_ExecuteJavascript>());
+	tests.push_back(new Constructor<Test_APIOverhead>());
+	tests.push_back(new Constructor<Test_JSValueConversion>());
+	tests.push_back(new Constructor<Test_Coroutines>());
 
 	size_t numTests = tests.size();
 	size_t numPassed = 0;